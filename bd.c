@@ -0,0 +1,349 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd.c
+ ** Descrição/Explicação do Módulo:
+ **     Implementação do acesso partilhado à BD (ver bd.h). A BD é mapeada com
+ **     MAP_SHARED, pelo que as escritas de cada Servidor Dedicado ficam visíveis a
+ **     todos os processos sem qualquer chamada ao sistema por pedido. O layout
+ **     (vetor de CheckIn ou colunar) é lido do cabeçalho do ficheiro.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "bd.h"
+#include "bd_scan.h"
+#include <sys/mman.h>
+
+#define BD_WRITE_BUFFER_SIZE (1 << 20)    // Bytes escritos em cada write() por bdWriteFile()
+
+static Bd bdOpen[BD_MAX_OPEN];       // BDs abertas por este processo (herdadas pelos filhos)
+static int bdOpenCount = 0;
+
+typedef struct {                     // Escrita com buffer de bdWriteFile()
+    int    fd;
+    char  *buffer;
+    size_t length;
+    int    failed;                   // Um write() falhou: o ficheiro temporário não é renomeado
+} BdWriter;
+
+/**
+ * @brief Abre a BD, lê o seu cabeçalho e, se map for TRUE, mapeia-a em memória. Abre também o seu índice,
+ *        se existir. Uma BD colunar é sempre mapeada: os acessos com pread()/pwrite() só conhecem o vetor de CheckIn
+ */
+static Bd *bdOpenFile (const char *nameDB, int writable, int map) {
+    struct stat statDB;
+    so_debug("< [@param nameDB:%s, writable:%d, map:%d]", nameDB, writable, map);
+
+    if (bdOpenCount == BD_MAX_OPEN) {
+        so_error("BD", "Demasiadas BDs abertas");
+        return NULL;
+    }
+
+    Bd *bd = &bdOpen[bdOpenCount];
+    snprintf(bd->name, sizeof(bd->name), "%s", nameDB);
+    bd->fd = open(nameDB, writable ? O_RDWR : O_RDONLY);
+    if (bd->fd == -1 || fstat(bd->fd, &statDB) == -1 || bdHeaderRead(bd->fd, statDB.st_size, &bd->header) == -1) {
+        so_error("BD", "Erro ao abrir %s", nameDB);
+        if (bd->fd != -1)
+            close(bd->fd);
+        return NULL;
+    }
+
+    bd->layout = bd->header.layout;
+    bd->count = bd->header.count;
+    bd->mapSize = bdDataEnd(&bd->header);       // Um índice embutido, a seguir aos dados, não é mapeado
+    bd->map = NULL;
+    if ((map || bd->layout == BD_LAYOUT_COLUMNS) && bd->count > 0) {    // mmap() não aceita zonas vazias
+        bd->map = mmap(NULL, bd->mapSize, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                       writable ? MAP_SHARED : MAP_PRIVATE, bd->fd, 0);
+        if (bd->map == MAP_FAILED) {
+            so_error("BD", "Erro ao mapear %s", nameDB);
+            close(bd->fd);
+            return NULL;
+        }
+    }
+    bd->records = bd->map ? (CheckIn *) ((char *) bd->map + bdRecordOffset(&bd->header, 0)) : NULL;
+    if (bd->layout == BD_LAYOUT_COLUMNS && bd->map) {
+        char *base = bd->map;
+        bd->nif = (int32_t *) (base + bdColumnOffset(bd->count, BD_COL_NIF));
+        bd->senha = (void *) (base + bdColumnOffset(bd->count, BD_COL_SENHA));
+        bd->nome = (void *) (base + bdColumnOffset(bd->count, BD_COL_NOME));
+        bd->nrVoo = (void *) (base + bdColumnOffset(bd->count, BD_COL_NRVOO));
+        bd->pidCliente = (int32_t *) (base + bdColumnOffset(bd->count, BD_COL_PID_CLIENTE));
+        bd->pidServidorDedicado = (int32_t *) (base + bdColumnOffset(bd->count, BD_COL_PID_SERVIDOR));
+    }
+    bdIndexOpen(&bd->index, nameDB, writable);
+
+    bdOpenCount++;
+    so_debug("> [count:%zu, map:%p]", bd->count, bd->map);
+    return bd;
+}
+
+/**
+ * @brief Abre a BD e mapeia-a em memória, qualquer que seja o seu layout (ver bd_format.h).
+ *        Abre também o seu índice, se existir
+ * @param nameDB   O nome da base de dados
+ * @param writable TRUE para mapear com MAP_SHARED e escrita (Servidor), FALSE só para leitura (ferramentas)
+ * @return Bd*     A BD aberta, ou NULL em caso de erro
+ */
+Bd *bdMapOpen (const char *nameDB, int writable) {
+    return bdOpenFile(nameDB, writable, TRUE);
+}
+
+/**
+ * @brief Abre a BD sem a mapear: os registos são lidos e escritos com pread()/pwrite() no descritor bd->fd,
+ *        aberto uma única vez e herdado pelos Servidores Dedicados (uma BD colunar é, ainda assim, mapeada)
+ * @param nameDB   O nome da base de dados
+ * @param writable TRUE para abrir com O_RDWR (Servidor), FALSE só para leitura (ferramentas)
+ * @return Bd*     A BD aberta, ou NULL em caso de erro
+ */
+Bd *bdFdOpen (const char *nameDB, int writable) {
+    return bdOpenFile(nameDB, writable, FALSE);
+}
+
+/**
+ * @brief Procura uma BD já aberta por este processo (ou pelo Servidor, antes do fork())
+ * @param nameDB O nome da base de dados
+ * @return Bd*   A BD aberta, ou NULL se não estiver aberta
+ */
+Bd *bdFind (const char *nameDB) {
+    for (int i = 0; i < bdOpenCount; i++)
+        if (!strcmp(bdOpen[i].name, nameDB))
+            return &bdOpen[i];
+    return NULL;
+}
+
+/**
+ * @brief Desfaz o mapeamento e fecha a BD e o seu índice
+ */
+void bdClose (Bd *bd) {
+    if (bd->map)
+        munmap(bd->map, bd->mapSize);
+    bd->map = NULL;
+    bdIndexClose(&bd->index);
+    close(bd->fd);
+    bd->fd = -1;
+    bd->name[0] = '\0';              // Deixa de ser encontrada por bdFind()
+}
+
+/**
+ * @brief Pesquisa sequencial de um NIF nos registos [first, bd->count), vetorizada se o CPU o permitir
+ *        (ver bd_scan.h). No layout colunar só é percorrida a coluna nif (4 bytes por registo); no legado,
+ *        o nif de cada CheckIn
+ * @return long O índice do primeiro registo com o NIF dado, ou -1 se não existir
+ */
+static long bdScanNifFrom (Bd *bd, size_t first, int nif) {
+    long found;
+    if (first >= bd->count)
+        return -1;
+    if (bd->layout == BD_LAYOUT_COLUMNS)
+        found = bdScanNifKernel(bd->nif + first, bd->count - first, 1, nif, BD_SCAN_AUTO);
+    else
+        found = bdScanNifKernel(&bd->records[first].nif, bd->count - first, sizeof(CheckIn) / sizeof(int32_t), nif, BD_SCAN_AUTO);
+    return found < 0 ? -1 : (long) first + found;
+}
+
+/**
+ * @brief Lê o registo i: da memória, se a BD estiver mapeada, ou com um único pread() do registo
+ * @return int 0 em caso de sucesso, -1 se o registo não existir ou em caso de erro
+ */
+int bdRead (Bd *bd, size_t i, CheckIn *record) {
+    if (i >= bd->count)
+        return -1;
+    if (bd->map) {
+        bdGet(bd, i, record);
+        return 0;
+    }
+    return pread(bd->fd, record, sizeof(CheckIn), bdRecordOffset(&bd->header, i)) == sizeof(CheckIn) ? 0 : -1;
+}
+
+/**
+ * @brief Escreve record no registo i: na memória, se a BD estiver mapeada, ou com um único pwrite()
+ * @return int 0 em caso de sucesso, -1 se o registo não existir ou em caso de erro
+ */
+int bdWrite (Bd *bd, size_t i, const CheckIn *record) {
+    if (i >= bd->count)
+        return -1;
+    if (bd->map) {
+        bdPut(bd, i, record);
+        return 0;
+    }
+    return pwrite(bd->fd, record, sizeof(CheckIn), bdRecordOffset(&bd->header, i)) == sizeof(CheckIn) ? 0 : -1;
+}
+
+/**
+ * @brief Lê o pidServidorDedicado do registo i (sem mapeamento, um pread() de 4 bytes)
+ * @return int 0 em caso de sucesso, -1 se o registo não existir ou em caso de erro
+ */
+int bdReadPidServidor (Bd *bd, size_t i, int *pidServidorDedicado) {
+    int32_t pid;
+    if (i >= bd->count)
+        return -1;
+    if (bd->map) {
+        *pidServidorDedicado = bdGetPidServidor(bd, i);
+        return 0;
+    }
+    if (pread(bd->fd, &pid, sizeof(pid), bdRecordOffset(&bd->header, i) + offsetof(CheckIn, pidServidorDedicado)) != sizeof(pid))
+        return -1;
+    *pidServidorDedicado = pid;
+    return 0;
+}
+
+/**
+ * @brief Altera os PIDs do registo i (sem mapeamento, um único pwrite() dos dois campos, que são contíguos)
+ * @return int 0 em caso de sucesso, -1 se o registo não existir ou em caso de erro
+ */
+int bdWritePids (Bd *bd, size_t i, int pidCliente, int pidServidorDedicado) {
+    int32_t pids[2] = { pidCliente, pidServidorDedicado };
+    _Static_assert(offsetof(CheckIn, pidServidorDedicado) == offsetof(CheckIn, pidCliente) + sizeof(int32_t),
+                   "pidCliente e pidServidorDedicado têm de ser contíguos");
+    if (i >= bd->count)
+        return -1;
+    if (bd->map) {
+        bdSetPids(bd, i, pidCliente, pidServidorDedicado);
+        return 0;
+    }
+    return pwrite(bd->fd, pids, sizeof(pids), bdRecordOffset(&bd->header, i) + offsetof(CheckIn, pidCliente)) == sizeof(pids) ? 0 : -1;
+}
+
+/**
+ * @brief Lê até count registos a partir do registo first, com um único pread() (só sem mapeamento)
+ * @return long O nº de registos lidos (0 no fim da BD), ou -1 em caso de erro
+ */
+long bdReadRange (Bd *bd, size_t first, CheckIn *records, size_t count) {
+    if (first >= bd->count)
+        return 0;
+    if (count > bd->count - first)
+        count = bd->count - first;   // Não lê um índice embutido
+    ssize_t n = pread(bd->fd, records, count * sizeof(CheckIn), bdRecordOffset(&bd->header, first));
+    return n < 0 ? -1 : n / (long) sizeof(CheckIn);
+}
+
+static int32_t bdNifAt (void *context, uint64_t i) {
+    return bdGetNif(context, i);
+}
+
+/**
+ * @brief Lê o nif do registo i com pread() (para bdInterpolationSearch() sem mapeamento)
+ */
+static int32_t bdReadNifAt (void *context, uint64_t i) {
+    Bd *bd = context;
+    int32_t nif;
+    if (pread(bd->fd, &nif, sizeof(nif), bdRecordOffset(&bd->header, i) + offsetof(CheckIn, nif)) != sizeof(nif))
+        return -1;
+    return nif;
+}
+
+/**
+ * @brief Pesquisa sequencial sem mapeamento: lê BD_READ_CHUNK registos por pread() e percorre-os com a
+ *        versão vetorizada (ver bd_scan.h)
+ * @param record Preenchido com o registo encontrado, já lido
+ */
+static long bdReadScanNifFrom (Bd *bd, size_t first, int nif, CheckIn *record) {
+    static _Thread_local CheckIn chunk[BD_READ_CHUNK];   // Um por thread (--threads)
+    long n, found;
+    while ((n = bdReadRange(bd, first, chunk, BD_READ_CHUNK)) > 0) {
+        if ((found = bdScanNifKernel(&chunk[0].nif, n, sizeof(CheckIn) / sizeof(int32_t), nif, BD_SCAN_AUTO)) >= 0) {
+            *record = chunk[found];
+            return first + found;
+        }
+        first += n;
+    }
+    return -1;
+}
+
+long bdScanNif (Bd *bd, int nif) {
+    CheckIn record;
+    return bd->map ? bdScanNifFrom(bd, 0, nif) : bdReadScanNifFrom(bd, 0, nif, &record);
+}
+
+/**
+ * @brief Pesquisa de um NIF sem índice. Numa BD ordenada (BD_FLAG_SORTED), é feita por interpolação nos
+ *        primeiros sortedCount registos e só os acrescentados depois são percorridos sequencialmente.
+ *        Sem mapeamento, cada passo da interpolação é um pread() do nif, e a pesquisa sequencial lê blocos
+ * @param record Se não for NULL, é preenchido com o registo encontrado
+ * @return long  O índice do registo com o NIF dado, ou -1 se não existir
+ */
+long bdSearchNif (Bd *bd, int nif, CheckIn *record) {
+    CheckIn found;
+    size_t first = bd->header.flags & BD_FLAG_SORTED ? bd->header.sortedCount : 0;
+    long i = -1;
+    if (first > 0)
+        i = bdInterpolationSearch(first, nif, bd->map ? bdNifAt : bdReadNifAt, bd);
+    if (i >= 0 && bdRead(bd, i, &found) != 0)
+        i = -1;
+    if (i < 0 && bd->map && (i = bdScanNifFrom(bd, first, nif)) >= 0)
+        bdGet(bd, i, &found);
+    else if (i < 0 && !bd->map)
+        i = bdReadScanNifFrom(bd, first, nif, &found);
+    if (i >= 0 && record)
+        *record = found;
+    return i;
+}
+
+static void bdWriterFlush (BdWriter *writer) {
+    size_t done = 0;
+    ssize_t n;
+    while (done < writer->length && ((n = write(writer->fd, writer->buffer + done, writer->length - done)) > 0 || errno == EINTR))
+        if (n > 0)
+            done += n;
+    writer->failed = writer->failed || done < writer->length;
+    writer->length = 0;
+}
+
+static void bdWriterPut (BdWriter *writer, const void *data, size_t size) {
+    if (writer->length + size > BD_WRITE_BUFFER_SIZE)
+        bdWriterFlush(writer);
+    memcpy(writer->buffer + writer->length, data, size);
+    writer->length += size;
+}
+
+/**
+ * @brief Escreve a BD nameDB (através de um ficheiro temporário, depois renomeado) no layout do cabeçalho: o cabeçalho
+ *        (só se withHeader; sem ele, é o formato legado) e os header->count registos, cada coluna de uma vez no layout
+ *        colunar. O registo i é o da posição order[i] (ou i, se order for NULL), lido com recordAt(context, ...)
+ * @return int 0 em caso de sucesso, -1 em caso de erro
+ */
+int bdWriteFile (const char *nameDB, BdHeader *header, int withHeader, const uint64_t *order, BdRecordAt recordAt,
+                 void *context) {
+    char nameTemp[PATH_MAX + 8];
+    CheckIn record;
+    BdWriter writer = { .fd = -1, .buffer = malloc(BD_WRITE_BUFFER_SIZE) };
+
+    snprintf(nameTemp, sizeof(nameTemp), "%s.tmp", nameDB);
+    if (!writer.buffer || (writer.fd = open(nameTemp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        so_error("BD", "Erro ao criar %s", nameTemp);
+        free(writer.buffer);
+        return -1;
+    }
+    if (withHeader) {
+        header->checksum = bdHeaderChecksum(header);
+        bdWriterPut(&writer, header, sizeof(BdHeader));
+    }
+    for (int column = 0; column < (header->layout == BD_LAYOUT_ROWS ? 1 : BD_COLUMNS); column++) {
+        for (size_t i = 0; i < header->count; i++) {
+            recordAt(context, order ? order[i] : i, &record);
+            if (header->layout == BD_LAYOUT_ROWS) {
+                bdWriterPut(&writer, &record, sizeof(record));
+                continue;
+            }
+            switch (column) {
+                case BD_COL_NIF:          bdWriterPut(&writer, &record.nif, sizeof(record.nif)); break;
+                case BD_COL_SENHA:        bdWriterPut(&writer, record.senha, sizeof(record.senha)); break;
+                case BD_COL_NOME:         bdWriterPut(&writer, record.nome, sizeof(record.nome)); break;
+                case BD_COL_NRVOO:        bdWriterPut(&writer, record.nrVoo, sizeof(record.nrVoo)); break;
+                case BD_COL_PID_CLIENTE:  bdWriterPut(&writer, &record.pidCliente, sizeof(record.pidCliente)); break;
+                case BD_COL_PID_SERVIDOR: bdWriterPut(&writer, &record.pidServidorDedicado, sizeof(record.pidServidorDedicado)); break;
+            }
+        }
+    }
+    bdWriterFlush(&writer);
+    free(writer.buffer);
+    if (close(writer.fd) == -1 || writer.failed || rename(nameTemp, nameDB) == -1) {
+        so_error("BD", "Erro ao escrever %s", nameDB);
+        unlink(nameTemp);
+        return -1;
+    }
+    return 0;
+}
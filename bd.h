@@ -0,0 +1,127 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd.h
+ ** Descrição/Explicação do Módulo:
+ **     Acesso à BD partilhado pelo Servidor e pelos Servidores Dedicados. O Servidor
+ **     abre a BD uma única vez (no passo S1) e os Servidores Dedicados herdam-na no fork().
+ **     A BD pode ser mapeada em memória (bdMapOpen()) ou só aberta (bdFdOpen()): nesse caso,
+ **     bdRead()/bdWrite() usam pread()/pwrite() no offset exato de cada registo, sem FILE*
+ **     nem lseek(). Sobre o mapeamento, os registos são lidos e escritos com bdGet()/bdPut(),
+ **     qualquer que seja o layout do ficheiro (vetor de CheckIn, ou colunar: ver bd_format.h).
+ **
+ ******************************************************************************/
+#ifndef __BD_H__
+#define __BD_H__
+
+#include <limits.h>
+#include "common.h"
+#include "bd_index.h"
+#include "bd_format.h"
+
+#define BD_MAX_OPEN 64          // Nº máximo de BDs abertas em simultâneo pelo Servidor
+#define BD_READ_CHUNK 512       // Registos lidos por pread() na pesquisa sequencial sem mapeamento (60 KB)
+
+/*** Acesso aos registos da BD pelo Servidor e pelos Servidores Dedicados (--io) ***/
+typedef enum {
+    BD_IO_PREAD = 0,            // BD aberta no passo S1; pread()/pwrite() no offset de cada registo (por omissão)
+    BD_IO_STDIO,                // fopen()/fseek()/fread()/fwrite() em cada pedido
+    BD_IO_MMAP                  // BD mapeada em memória no passo S1 (MAP_SHARED)
+} BdIo;
+
+typedef struct {
+    char     name[PATH_MAX];    // Nome do ficheiro da BD
+    int      fd;                // Descritor da BD, herdado pelos Servidores Dedicados
+    BdHeader header;            // Cabeçalho da BD (preenchido por bdHeaderRead(), mesmo sem cabeçalho no ficheiro)
+    BdLayout layout;            // Layout do ficheiro (BD_LAYOUT_ROWS ou BD_LAYOUT_COLUMNS)
+    void    *map;               // Ficheiro mapeado em memória (MAP_SHARED), ou NULL (BD vazia, ou aberta com bdFdOpen())
+    size_t   mapSize;           // Tamanho (em bytes) da zona mapeada
+    size_t   count;             // Nº de registos da BD
+    CheckIn *records;           // BD_LAYOUT_ROWS: os registos
+    int32_t *nif;               // BD_LAYOUT_COLUMNS: as colunas (ver bd_format.h)
+    char   (*senha)[40];
+    char   (*nome)[60];
+    char   (*nrVoo)[8];
+    int32_t *pidCliente;
+    int32_t *pidServidorDedicado;
+    BdIndex  index;             // Índice de hash da BD (index.fd == -1 se não existir)
+} Bd;
+
+Bd  *bdMapOpen (const char *, int); // Abre e mapeia a BD em memória (MAP_SHARED se for para escrita)
+Bd  *bdFdOpen (const char *, int);  // Abre a BD sem a mapear (os registos são acedidos com pread()/pwrite())
+Bd  *bdFind (const char *);     // A BD com o nome dado, se já estiver aberta; NULL caso contrário
+void bdClose (Bd *);            // Desfaz o mapeamento e fecha a BD
+long bdScanNif (Bd *, int);     // Pesquisa sequencial de um NIF (índice do registo, ou -1)
+long bdSearchNif (Bd *, int, CheckIn *); // Pesquisa de um NIF sem índice: por interpolação, se a BD estiver ordenada
+
+/*** Com ou sem mapeamento: 0 em caso de sucesso, -1 se o registo não existir ou em caso de erro ***/
+int  bdRead (Bd *, size_t, CheckIn *);            // Lê o registo i
+int  bdWrite (Bd *, size_t, const CheckIn *);     // Escreve o registo i
+int  bdReadPidServidor (Bd *, size_t, int *);     // Lê o pidServidorDedicado do registo i
+int  bdWritePids (Bd *, size_t, int, int);        // Altera o pidCliente e o pidServidorDedicado do registo i
+long bdReadRange (Bd *, size_t, CheckIn *, size_t); // Sem mapeamento: lê até n registos (nº lido, ou -1)
+
+/*** Escrita de uma BD completa pelas ferramentas (bd_convert, bd_sort, bd_reshard) ***/
+typedef void (*BdRecordAt) (void *, uint64_t, CheckIn *); // Copia para o CheckIn o registo na posição dada
+int  bdWriteFile (const char *, BdHeader *, int, const uint64_t *, BdRecordAt, void *); // 0, ou -1 em caso de erro
+
+/**
+ * @brief Copia o registo i da BD para record
+ */
+static inline void bdGet (const Bd *bd, size_t i, CheckIn *record) {
+    if (bd->layout == BD_LAYOUT_ROWS) {
+        *record = bd->records[i];
+        return;
+    }
+    record->nif = bd->nif[i];
+    memcpy(record->senha, bd->senha[i], sizeof(record->senha));
+    memcpy(record->nome, bd->nome[i], sizeof(record->nome));
+    memcpy(record->nrVoo, bd->nrVoo[i], sizeof(record->nrVoo));
+    record->pidCliente = bd->pidCliente[i];
+    record->pidServidorDedicado = bd->pidServidorDedicado[i];
+}
+
+/**
+ * @brief Escreve record no registo i da BD
+ */
+static inline void bdPut (Bd *bd, size_t i, const CheckIn *record) {
+    if (bd->layout == BD_LAYOUT_ROWS) {
+        bd->records[i] = *record;
+        return;
+    }
+    bd->nif[i] = record->nif;
+    memcpy(bd->senha[i], record->senha, sizeof(record->senha));
+    memcpy(bd->nome[i], record->nome, sizeof(record->nome));
+    memcpy(bd->nrVoo[i], record->nrVoo, sizeof(record->nrVoo));
+    bd->pidCliente[i] = record->pidCliente;
+    bd->pidServidorDedicado[i] = record->pidServidorDedicado;
+}
+
+/**
+ * @brief O nif do registo i
+ */
+static inline int bdGetNif (const Bd *bd, size_t i) {
+    return bd->layout == BD_LAYOUT_ROWS ? bd->records[i].nif : bd->nif[i];
+}
+
+/**
+ * @brief O pidServidorDedicado do registo i
+ */
+static inline int bdGetPidServidor (const Bd *bd, size_t i) {
+    return bd->layout == BD_LAYOUT_ROWS ? bd->records[i].pidServidorDedicado : bd->pidServidorDedicado[i];
+}
+
+/**
+ * @brief Altera os PIDs do registo i (e.g., -1 no fim da sessão, em SD13)
+ */
+static inline void bdSetPids (Bd *bd, size_t i, int pidCliente, int pidServidorDedicado) {
+    if (bd->layout == BD_LAYOUT_ROWS) {
+        bd->records[i].pidCliente = pidCliente;
+        bd->records[i].pidServidorDedicado = pidServidorDedicado;
+    } else {
+        bd->pidCliente[i] = pidCliente;
+        bd->pidServidorDedicado[i] = pidServidorDedicado;
+    }
+}
+
+#endif  // __BD_H__
@@ -0,0 +1,121 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_bench_scan.c
+ ** Descrição/Explicação do Módulo:
+ **     Microbenchmark da pesquisa sequencial de NIFs (ver bd_scan.h). Para cada
+ **     tamanho de BD, preenche em memória uma coluna nif e/ou um vetor de CheckIn
+ **     e mede, para cada versão suportada pelo CPU, quantos registos por segundo
+ **     são percorridos numa pesquisa sem sucesso (o pior caso de SD10).
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include "bd_scan.h"
+#include <getopt.h>
+#include <time.h>
+
+#define BENCH_MIN_SECONDS 0.25       // Tempo mínimo medido por versão e tamanho
+
+static double now () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Mede uma versão: repete a pesquisa de um NIF inexistente até passarem BENCH_MIN_SECONDS
+ * @return double Registos percorridos por segundo
+ */
+static double measure (const int32_t *nifs, size_t count, size_t stride, BdScanKernel kernel) {
+    long repeats = 0;
+    volatile long sink = 0;
+    double start = now(), elapsed;
+    do {
+        sink += bdScanNifKernel(nifs, count, stride, 0, kernel);   // NIF 0 nunca existe
+        repeats++;
+    } while ((elapsed = now() - start) < BENCH_MIN_SECONDS);
+    return (double) count * repeats / elapsed;
+}
+
+/**
+ * @brief Mede todas as versões sobre count registos, após confirmar que todas encontram o mesmo registo
+ */
+static void benchmark (const char *layout, const int32_t *nifs, size_t count, size_t stride) {
+    static const BdScanKernel kernels[] = { BD_SCAN_SCALAR, BD_SCAN_SSE41, BD_SCAN_AVX2 };
+    size_t target = count - 1 - count / 7;           // Um registo que não está no início de um bloco
+    double scalar = 0;
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!bdScanKernelSupported(kernels[k]))
+            continue;
+        if (bdScanNifKernel(nifs, count, stride, nifs[target * stride], kernels[k]) != (long) target) {
+            so_error("BENCH", "%s: resultado errado em %s", bdScanKernelName(kernels[k]), layout);
+            exit(1);
+        }
+        double rate = measure(nifs, count, stride, kernels[k]);
+        if (kernels[k] == BD_SCAN_SCALAR)
+            scalar = rate;
+        printf("%-8s %12zu  %-7s %10.1f Mregistos/s  %5.2fx\n", layout, count, bdScanKernelName(kernels[k]),
+               rate / 1e6, rate / scalar);
+        fflush(stdout);
+    }
+}
+
+int main (int argc, char *argv[]) {
+    static struct option options[] = {
+        { "layout", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 }
+    };
+    int columns = TRUE, rows = TRUE, option;
+
+    while ((option = getopt_long(argc, argv, "l:", options, NULL)) != -1) {
+        if (option == 'l' && !strcmp(optarg, "columns"))
+            rows = FALSE;
+        else if (option == 'l' && !strcmp(optarg, "rows"))
+            columns = FALSE;
+        else if (option != 'l' || strcmp(optarg, "both")) {
+            printf("Uso: %s [opções] [N...]\n"
+                   "  -l, --layout LAYOUT     columns, rows ou both (por omissão)\n"
+                   "N: nº de registos de cada BD (por omissão 1e4 1e5 1e6 1e7 1e8)\n",
+                   argv[0]);
+            exit(1);
+        }
+    }
+    size_t defaults[] = { 10000, 100000, 1000000, 10000000, 100000000 };
+    int nSizes = optind < argc ? argc - optind : (int) (sizeof(defaults) / sizeof(defaults[0]));
+
+    printf("Versão escolhida neste CPU: %s\n", bdScanKernelName(BD_SCAN_AUTO));
+    printf("layout   %12s  versão  %22s  speedup\n", "registos", "débito");
+    for (int s = 0; s < nSizes; s++) {
+        size_t count = optind < argc ? (size_t) strtod(argv[optind + s], NULL) : defaults[s];
+        if (count == 0)
+            continue;
+        if (columns) {
+            int32_t *nifs = malloc(count * sizeof(int32_t));
+            if (!nifs)
+                printf("columns  %12zu  (sem memória)\n", count);
+            else {
+                for (size_t i = 0; i < count; i++)
+                    nifs[i] = 100000000 + i;
+                benchmark("columns", nifs, count, 1);
+                free(nifs);
+            }
+        }
+        if (rows) {
+            CheckIn *records = malloc(count * sizeof(CheckIn));
+            if (!records)
+                printf("rows     %12zu  (sem memória)\n", count);
+            else {
+                for (size_t i = 0; i < count; i++) {
+                    memset(&records[i], 0, sizeof(CheckIn));
+                    records[i].nif = 100000000 + i;
+                }
+                benchmark("rows", &records[0].nif, count, sizeof(CheckIn) / sizeof(int32_t));
+                free(records);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,279 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_commit.c
+ ** Descrição/Explicação do Módulo:
+ **     Implementação da durabilidade dos check-ins (ver bd_commit.h). No modo group,
+ **     o nº de sequência de cada registo é obtido depois de o registo estar escrito,
+ **     pelo que qualquer fdatasync() que o flusher comece depois disso o cobre. O
+ **     flusher só é acordado pelo primeiro registo pendente e pelo K-ésimo; os
+ **     restantes Servidores Dedicados só incrementam o contador e esperam.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include "bd_commit.h"
+#include "procutil.h"
+#include <sys/mman.h>
+
+#define BD_COMMIT_CHECK_MS 100       // Com o flusher parado há mais do que isto, o Servidor Dedicado confirma se ainda existe
+
+typedef struct {
+    atomic_ulong requested;          // Nº de sequência do último registo escrito
+    atomic_ulong durable;            // Nº de sequência do último registo coberto por um fdatasync()
+    atomic_uint  pending;            // Futex do flusher: incrementado quando há trabalho para ele
+    atomic_uint  wake;               // Futex dos Servidores Dedicados: incrementado no fim de cada fdatasync()
+    atomic_ulong dirty;              // Ficheiros com registos escritos desde o último sync (um bit por ficheiro)
+    atomic_int   failed;             // Um fdatasync() falhou: a partir daí, nenhum commit é confirmado
+    atomic_long  commits;            // Estatísticas mostradas em S6
+    atomic_long  syncs;
+    atomic_ulong latencyTotal;       // Soma das latências (µs)
+    atomic_ulong latencyMax;
+    atomic_long  latency[BD_COMMIT_BUCKETS];
+} BdCommitShared;
+
+static BdDurability durability;
+static char *const *commitNames;     // Os ficheiros da BD (um só, sem --shards)
+static int commitFds[BD_COMMIT_FILES_MAX];   // Abertos no passo S1 e herdados pelos Servidores Dedicados (só para fdatasync())
+static int commitFiles;
+static pid_t flusherPid;
+static BdCommitShared *commitShared; // NULL com --durability none
+
+static long elapsedMicros (const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000L + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+/* Intervalo do histograma de uma latência: 0..3 µs têm um intervalo cada; depois, 4 por potência de 2 */
+static int latencyBucket (unsigned long micros) {
+    if (micros < 4)
+        return micros;
+    int msb = 63 - __builtin_clzl(micros);
+    int bucket = 4 * (msb - 1) + ((micros >> (msb - 2)) & 3);
+    return bucket < BD_COMMIT_BUCKETS ? bucket : BD_COMMIT_BUCKETS - 1;
+}
+
+/* Maior latência (µs) do intervalo bucket */
+static unsigned long bucketLimit (int bucket) {
+    if (bucket < 4)
+        return bucket;
+    int msb = bucket / 4 + 1;
+    return ((5UL + bucket % 4) << (msb - 2)) - 1;
+}
+
+/**
+ * @brief Interpreta o argumento de --durability: none, record, ou group[:MS[,K]]
+ * @return int 0 em caso de sucesso, -1 se o modo for inválido
+ */
+int bdDurabilityParse (const char *text, BdDurability *result) {
+    BdDurability parsed = { BD_DURABILITY_GROUP, BD_COMMIT_INTERVAL_MS, BD_COMMIT_BATCH };
+    char end;
+
+    if (!strcmp(text, "none"))
+        parsed.kind = BD_DURABILITY_NONE;
+    else if (!strcmp(text, "record"))
+        parsed.kind = BD_DURABILITY_RECORD;
+    else if (strcmp(text, "group") && sscanf(text, "group:%d%c", &parsed.intervalMs, &end) != 1 &&
+             sscanf(text, "group:%d,%d%c", &parsed.intervalMs, &parsed.batch, &end) != 2)
+        return -1;
+    if (parsed.intervalMs < 0 || parsed.batch < 1)
+        return -1;
+    *result = parsed;
+    return 0;
+}
+
+/**
+ * @brief Descrição do modo de durabilidade, no formato de --durability
+ */
+void bdDurabilityFormat (const BdDurability *mode, char *buffer, size_t size) {
+    if (mode->kind == BD_DURABILITY_GROUP)
+        snprintf(buffer, size, "group:%d,%d", mode->intervalMs, mode->batch);
+    else
+        snprintf(buffer, size, "%s", mode->kind == BD_DURABILITY_RECORD ? "record" : "none");
+}
+
+/**
+ * @brief O fdatasync() dos ficheiros com um bit em files
+ * @return int 0 em caso de sucesso, -1 se algum falhar
+ */
+static int syncFiles (unsigned long files) {
+    int result = 0;
+    for (int i = 0; i < commitFiles; i++)
+        if (files & 1UL << i && fdatasync(commitFds[i]) != 0)
+            result = -1;
+    return result;
+}
+
+/**
+ * @brief Ciclo do flusher: espera por registos pendentes e, quando forem K ou o primeiro tiver MS milissegundos,
+ *        faz um fdatasync() que cobre todos os nºs de sequência já distribuídos. Com --shards, só são
+ *        sincronizados os ficheiros escritos desde o sync anterior. Termina com o Servidor
+ */
+static void runFlusher () {
+    for (;;) {
+        unsigned pending = atomic_load(&commitShared->pending);   // Lido antes de requested: não perde um registo
+        unsigned long durable = atomic_load(&commitShared->durable);
+        if (atomic_load(&commitShared->requested) == durable) {
+            futexWait(&commitShared->pending, pending, -1, FUTEX_SHARED);
+            continue;
+        }
+        struct timespec first;
+        clock_gettime(CLOCK_MONOTONIC, &first);
+        for (;;) {
+            long remaining = durability.intervalMs * 1000L - elapsedMicros(&first);
+            pending = atomic_load(&commitShared->pending);
+            if (remaining <= 0 || atomic_load(&commitShared->requested) - durable >= (unsigned long) durability.batch)
+                break;
+            futexWait(&commitShared->pending, pending, remaining, FUTEX_SHARED);
+        }
+        unsigned long target = atomic_load(&commitShared->requested);     // Os bits destes registos já estão em dirty
+        if (syncFiles(atomic_exchange(&commitShared->dirty, 0)) == 0) {
+            atomic_store(&commitShared->durable, target);
+            atomic_fetch_add(&commitShared->syncs, 1);
+        } else {
+            so_error("BD", "Erro no fdatasync() da BD");
+            atomic_store(&commitShared->failed, TRUE);
+        }
+        atomic_fetch_add(&commitShared->wake, 1);
+        futexWake(&commitShared->wake, INT_MAX, FUTEX_SHARED);
+    }
+}
+
+/**
+ * @brief Prepara a durabilidade dos check-ins: abre os ficheiros da BD (herdados pelos Servidores Dedicados) e, no
+ *        modo group, cria o flusher. Chamada pelo Servidor no passo S1, antes de qualquer outro fork()
+ * @param names  Os nomes dos ficheiros da BD (mantidos até ao fim do Servidor)
+ * @param n      O nº de ficheiros (1, sem --shards)
+ * @param mode   O modo de --durability
+ * @return int   0 em caso de sucesso, -1 em caso de erro
+ */
+int bdCommitStart (char *const names[], int n, BdDurability mode) {
+    so_debug("< [@param names[0]:%s, n:%d, kind:%d]", names[0], n, mode.kind);
+    durability = mode;
+    if (mode.kind == BD_DURABILITY_NONE)
+        return 0;
+    commitShared = mmap(NULL, sizeof(BdCommitShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (commitShared == MAP_FAILED || n > BD_COMMIT_FILES_MAX) {
+        so_error("BD", "Erro ao preparar a durabilidade de %s", names[0]);
+        commitShared = NULL;
+        return -1;
+    }
+    commitNames = names;
+    for (commitFiles = 0; commitFiles < n; commitFiles++) {
+        if ((commitFds[commitFiles] = open(names[commitFiles], O_RDONLY)) == -1) {
+            so_error("BD", "Erro ao preparar a durabilidade de %s", names[commitFiles]);
+            commitShared = NULL;
+            return -1;
+        }
+    }
+    if (mode.kind == BD_DURABILITY_GROUP) {
+        if ((flusherPid = forkBackground()) == -1) {
+            so_error("BD", "Erro ao criar o flusher");
+            return -1;
+        }
+        if (flusherPid == 0)
+            runFlusher();
+    }
+    so_debug("> [flusher:%d]", flusherPid);
+    return 0;
+}
+
+/**
+ * @brief TRUE se o flusher já não existir (e.g., o Servidor terminou a meio do pedido). Nesse caso, quem espera
+ *        faz o fdatasync() ele próprio
+ */
+static int flusherGone () {
+    return kill(flusherPid, 0) == -1 && errno == ESRCH;
+}
+
+/**
+ * @brief Espera que o registo que este processo acabou de escrever esteja em disco, segundo o modo de --durability.
+ *        Com stdio, o registo já tem de ter saído do buffer (fflush()). Com mmap, o fdatasync() da BD também
+ *        escreve as páginas alteradas através do mapeamento
+ * @param nameDB O ficheiro da BD onde o registo foi escrito (um dos passados a bdCommitStart())
+ * @return int   0 em caso de sucesso (ou com none), -1 se o registo não ficou em disco
+ */
+int bdCommitWait (const char *nameDB) {
+    struct timespec start;
+    int file = 0, result = 0;
+    if (!commitShared)
+        return 0;
+    while (file < commitFiles && strcmp(commitNames[file], nameDB))
+        file++;
+    if (file == commitFiles)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (durability.kind == BD_DURABILITY_RECORD) {
+        result = fdatasync(commitFds[file]);
+        if (result == 0)
+            atomic_fetch_add(&commitShared->syncs, 1);
+    } else {
+        atomic_fetch_or(&commitShared->dirty, 1UL << file);             // Antes do nº de sequência: o sync que o cobre vê o bit
+        unsigned long ticket = atomic_fetch_add(&commitShared->requested, 1) + 1;
+        unsigned long backlog = ticket - atomic_load(&commitShared->durable);
+        atomic_fetch_add(&commitShared->pending, 1);
+        if (backlog == 1 || backlog == (unsigned long) durability.batch)   // Flusher parado, ou lote completo
+            futexWake(&commitShared->pending, INT_MAX, FUTEX_SHARED);
+        for (;;) {
+            unsigned wake = atomic_load(&commitShared->wake);            // Lido antes de durable: não perde um sync
+            if (atomic_load(&commitShared->failed)) {
+                result = -1;
+                break;
+            }
+            if (atomic_load(&commitShared->durable) >= ticket)
+                break;
+            if (elapsedMicros(&start) > (durability.intervalMs + BD_COMMIT_CHECK_MS) * 1000L && flusherGone()) {
+                result = syncFiles(~0UL);
+                break;
+            }
+            futexWait(&commitShared->wake, wake, BD_COMMIT_CHECK_MS * 1000L, FUTEX_SHARED);
+        }
+    }
+    if (result != 0)
+        return -1;
+    unsigned long micros = elapsedMicros(&start), max = atomic_load(&commitShared->latencyMax);
+    atomic_fetch_add(&commitShared->commits, 1);
+    atomic_fetch_add(&commitShared->latencyTotal, micros);
+    atomic_fetch_add(&commitShared->latency[latencyBucket(micros)], 1);
+    while (micros > max && !atomic_compare_exchange_weak(&commitShared->latencyMax, &max, micros));
+    return 0;
+}
+
+/**
+ * @return pid_t O PID do flusher de --durability group, ou 0 se não houver flusher
+ */
+pid_t bdCommitFlusher () {
+    return flusherPid;
+}
+
+/**
+ * @brief Estatísticas dos commits, partilhadas por todos os processos. Os percentis são o limite superior do
+ *        respetivo intervalo do histograma (erro inferior a 25%)
+ * @return int 0 em caso de sucesso, -1 com --durability none
+ */
+int bdCommitStats (BdCommitStats *result) {
+    if (!commitShared)
+        return -1;
+    long count[BD_COMMIT_BUCKETS], seen = 0;
+    *result = (BdCommitStats) { .commits = atomic_load(&commitShared->commits), .syncs = atomic_load(&commitShared->syncs) };
+    if (result->commits == 0)
+        return 0;
+    for (int i = 0; i < BD_COMMIT_BUCKETS; i++)
+        count[i] = atomic_load(&commitShared->latency[i]);
+    result->meanMs = atomic_load(&commitShared->latencyTotal) / 1000.0 / result->commits;
+    result->maxMs = atomic_load(&commitShared->latencyMax) / 1000.0;
+    for (int i = 0; i < BD_COMMIT_BUCKETS; i++) {
+        if (seen < result->commits * 0.50 && seen + count[i] >= result->commits * 0.50)
+            result->p50Ms = bucketLimit(i) / 1000.0;
+        if (seen < result->commits * 0.99 && seen + count[i] >= result->commits * 0.99)
+            result->p99Ms = bucketLimit(i) / 1000.0;
+        seen += count[i];
+    }
+    if (result->p99Ms > result->maxMs)
+        result->p99Ms = result->maxMs;
+    if (result->p50Ms > result->maxMs)
+        result->p50Ms = result->maxMs;
+    return 0;
+}
@@ -0,0 +1,50 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_commit.h
+ ** Descrição/Explicação do Módulo:
+ **     Durabilidade dos check-ins escritos na BD (--durability). Com none, o registo
+ **     fica na page cache, como sempre. Com record, cada Servidor Dedicado faz o
+ **     seu fdatasync() depois de SD11. Com group, um único processo (o flusher,
+ **     criado no passo S1) faz os fdatasync(): cada Servidor Dedicado recebe um nº
+ **     de sequência depois de escrever o registo e espera, num futex em memória
+ **     partilhada, que o nº de sequência já em disco o alcance. O flusher faz o sync
+ **     quando há K registos pendentes, ou MS milissegundos depois do primeiro.
+ **
+ ******************************************************************************/
+#ifndef __BD_COMMIT_H__
+#define __BD_COMMIT_H__
+
+#include <stddef.h>
+
+#define BD_COMMIT_INTERVAL_MS  2     // Valor por omissão de MS em --durability group:MS,K
+#define BD_COMMIT_BATCH        16    // Valor por omissão de K
+#define BD_COMMIT_BUCKETS      96    // Histograma das latências: 4 intervalos por potência de 2 (em µs)
+#define BD_COMMIT_FILES_MAX    64    // Nº máximo de ficheiros da BD (--shards), cada um com o seu fdatasync()
+
+typedef enum {
+    BD_DURABILITY_NONE = 0,          // Sem fdatasync() (por omissão)
+    BD_DURABILITY_RECORD,            // Um fdatasync() por check-in, feito pelo próprio Servidor Dedicado
+    BD_DURABILITY_GROUP              // Group commit, com um único flusher
+} BdDurabilityKind;
+
+typedef struct {
+    BdDurabilityKind kind;
+    int intervalMs;                  // group: espera máxima desde o primeiro registo pendente
+    int batch;                       // group: nº de registos pendentes que provoca logo o sync
+} BdDurability;
+
+typedef struct {
+    long   commits;                  // Nº de check-ins que esperaram pela durabilidade
+    long   syncs;                    // Nº de fdatasync() da BD
+    double meanMs, p50Ms, p99Ms, maxMs; // Latência do commit (da escrita do registo até estar em disco)
+} BdCommitStats;
+
+int  bdDurabilityParse (const char *, BdDurability *);  // none, record ou group[:MS[,K]] (0 = sucesso)
+void bdDurabilityFormat (const BdDurability *, char *, size_t); // O inverso de bdDurabilityParse()
+int  bdCommitStart (char *const [], int, BdDurability); // Abre os ficheiros da BD e cria o flusher (0 = sucesso)
+int  bdCommitWait (const char *);                       // Espera que o registo escrito esteja em disco (0 = sucesso)
+int  bdCommitStats (BdCommitStats *);                   // Estatísticas partilhadas (-1 com none)
+pid_t bdCommitFlusher ();                               // PID do flusher (0 se não houver)
+
+#endif  // __BD_COMMIT_H__
@@ -0,0 +1,225 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_dump.c
+ ** Descrição/Explicação do Módulo:
+ **     Ferramenta que mostra os registos CheckIn de uma BD, em substituição de
+ **     so_show_binary_checkin_file.sh. A BD é mapeada em memória e cada registo é
+ **     formatado diretamente num buffer de saída, escrito com write() em blocos de
+ **     1 MB, sem printf() por campo. Aceita os dois layouts da BD (ver bd_format.h).
+ **     Permite filtrar por intervalo de NIFs, por voo
+ **     e por sessões abertas, e mostrar o resultado em tabela, CSV ou JSON, ou só
+ **     contá-lo (--count).
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "bd.h"
+#include <getopt.h>
+#include <sys/mman.h>
+
+#define DUMP_BUFFER_SIZE (1 << 20)   // Tamanho do buffer de saída
+#define DUMP_RECORD_MAX  1024        // Espaço máximo ocupado por um registo formatado (JSON com escapes)
+
+typedef enum { FORMAT_TABLE, FORMAT_CSV, FORMAT_JSON } DumpFormat;
+
+static char output[DUMP_BUFFER_SIZE];
+static size_t outputLength = 0;
+
+static void flushOutput () {
+    size_t done = 0;
+    ssize_t n;
+    while (done < outputLength && ((n = write(STDOUT_FILENO, output + done, outputLength - done)) > 0 || errno == EINTR))
+        if (n > 0)
+            done += n;
+    if (done < outputLength) {
+        so_error("DUMP", "Erro ao escrever no STDOUT");
+        exit(1);
+    }
+    outputLength = 0;
+}
+
+static void putChar (char c) {
+    output[outputLength++] = c;
+}
+
+static void putText (const char *text) {
+    while (*text)
+        output[outputLength++] = *text++;
+}
+
+/**
+ * @brief Escreve o campo de texto field (com tamanho máximo size, pode não terminar em '\0'), alinhado à
+ *        esquerda em width colunas. Em CSV, põe o campo entre aspas se for preciso; em JSON, faz os escapes
+ */
+static void putField (const char *field, size_t size, int width, DumpFormat format) {
+    size_t length = strnlen(field, size);
+    if (format == FORMAT_CSV && (memchr(field, ',', length) || memchr(field, '"', length))) {
+        putChar('"');
+        for (size_t i = 0; i < length; i++) {
+            if (field[i] == '"')
+                putChar('"');
+            putChar(field[i]);
+        }
+        putChar('"');
+        return;
+    }
+    if (format == FORMAT_JSON) {
+        putChar('"');
+        for (size_t i = 0; i < length; i++) {
+            unsigned char c = field[i];
+            if (c == '"' || c == '\\') {
+                putChar('\\');
+                putChar(c);
+            } else if (c < 0x20) {
+                outputLength += sprintf(output + outputLength, "\\u%04x", c);
+            } else
+                putChar(c);
+        }
+        putChar('"');
+        return;
+    }
+    memcpy(output + outputLength, field, length);
+    outputLength += length;
+    for (int i = length; i < width; i++)
+        putChar(' ');
+}
+
+/**
+ * @brief Escreve o inteiro value com pelo menos width algarismos (zeros à esquerda se zeroPad) ou, se não,
+ *        alinhado à esquerda em width colunas
+ */
+static void putInt (int value, int width, int zeroPad) {
+    char digits[12];
+    int n = 0;
+    unsigned int magnitude = value < 0 ? -(unsigned int) value : (unsigned int) value;
+    do {
+        digits[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    int length = n + (value < 0);
+    if (value < 0)
+        putChar('-');
+    for (int i = length; zeroPad && i < width; i++)
+        putChar('0');
+    while (n)
+        putChar(digits[--n]);
+    for (int i = length; !zeroPad && i < width; i++)
+        putChar(' ');
+}
+
+/**
+ * @brief Escreve um registo no formato pedido
+ */
+static void putRecord (const CheckIn *record, DumpFormat format, int first) {
+    switch (format) {
+        case FORMAT_TABLE:           // Mesmo formato que so_show_binary_checkin_file.sh
+            putText("| ");   putInt(record->nif, 9, TRUE);
+            putText(" | ");  putField(record->senha, sizeof(record->senha), 9, format);
+            putText(" | ");  putField(record->nome, sizeof(record->nome), 19, format);
+            putText(" | ");  putField(record->nrVoo, sizeof(record->nrVoo), 6, format);
+            putText(" | ");  putInt(record->pidCliente, 10, FALSE);
+            putText(" | ");  putInt(record->pidServidorDedicado, 19, FALSE);
+            putText(" |\n");
+            break;
+        case FORMAT_CSV:
+            putInt(record->nif, 0, FALSE);                                   putChar(',');
+            putField(record->senha, sizeof(record->senha), 0, format);      putChar(',');
+            putField(record->nome, sizeof(record->nome), 0, format);        putChar(',');
+            putField(record->nrVoo, sizeof(record->nrVoo), 0, format);      putChar(',');
+            putInt(record->pidCliente, 0, FALSE);                            putChar(',');
+            putInt(record->pidServidorDedicado, 0, FALSE);                   putChar('\n');
+            break;
+        case FORMAT_JSON:
+            putText(first ? "  {\"nif\": " : ",\n  {\"nif\": ");             putInt(record->nif, 0, FALSE);
+            putText(", \"senha\": ");   putField(record->senha, sizeof(record->senha), 0, format);
+            putText(", \"nome\": ");    putField(record->nome, sizeof(record->nome), 0, format);
+            putText(", \"nrVoo\": ");   putField(record->nrVoo, sizeof(record->nrVoo), 0, format);
+            putText(", \"pidCliente\": ");            putInt(record->pidCliente, 0, FALSE);
+            putText(", \"pidServidorDedicado\": ");   putInt(record->pidServidorDedicado, 0, FALSE);
+            putChar('}');
+            break;
+    }
+}
+
+int main (int argc, char *argv[]) {
+    static struct option options[] = {
+        { "nif", required_argument, NULL, 'n' },
+        { "voo", required_argument, NULL, 'v' },
+        { "live", no_argument, NULL, 'l' },
+        { "format", required_argument, NULL, 'f' },
+        { "count", no_argument, NULL, 'c' },
+        { NULL, 0, NULL, 0 }
+    };
+    int nifMin = 0, nifMax = 999999999, liveOnly = FALSE, countOnly = FALSE, option;
+    char *voo = NULL;
+    DumpFormat format = FORMAT_TABLE;
+
+    while ((option = getopt_long(argc, argv, "n:v:lf:c", options, NULL)) != -1) {
+        switch (option) {
+            case 'n':
+                if (sscanf(optarg, "%d-%d", &nifMin, &nifMax) != 2 && sscanf(optarg, "%d", &nifMin) == 1)
+                    nifMax = nifMin;
+                break;
+            case 'v': voo = optarg; break;
+            case 'l': liveOnly = TRUE; break;
+            case 'c': countOnly = TRUE; break;
+            case 'f':
+                if (!strcmp(optarg, "table")) format = FORMAT_TABLE;
+                else if (!strcmp(optarg, "csv")) format = FORMAT_CSV;
+                else if (!strcmp(optarg, "json")) format = FORMAT_JSON;
+                else option = '?';
+                if (option != '?')
+                    break;
+                // fall through
+            default:
+                printf("Uso: %s [opções] [<binary-file.dat>]\n"
+                       "  -n, --nif MIN[-MAX]     Só os NIFs entre MIN e MAX (inclusive)\n"
+                       "  -v, --voo NRVOO         Só os passageiros do voo NRVOO\n"
+                       "  -l, --live              Só os registos com uma sessão aberta (pidCliente ou pidServidorDedicado > 0)\n"
+                       "  -f, --format FORMATO    table (por omissão), csv ou json\n"
+                       "  -c, --count             Mostra só o nº de registos (e de sessões abertas) que passam os filtros\n",
+                       argv[0]);
+                exit(1);
+        }
+    }
+    char *nameDB = optind < argc ? argv[optind] : FILE_DATABASE;
+
+    Bd *bd = bdMapOpen(nameDB, FALSE);
+    if (!bd)
+        exit(1);
+    size_t count = bd->count;
+    if (bd->map)
+        madvise(bd->map, bd->mapSize, MADV_SEQUENTIAL);
+
+    long matched = 0, live = 0;
+    if (!countOnly && format == FORMAT_TABLE)
+        putText("|    nif    |   senha   |        nome         |  nrVoo | pidCliente | pidServidorDedicado |\n");
+    if (!countOnly && format == FORMAT_CSV)
+        putText("nif,senha,nome,nrVoo,pidCliente,pidServidorDedicado\n");
+    if (!countOnly && format == FORMAT_JSON)
+        putText("[\n");
+
+    for (size_t i = 0; i < count; i++) {
+        CheckIn checkIn, *record = &checkIn;
+        bdGet(bd, i, record);
+        int isLive = record->pidCliente > 0 || record->pidServidorDedicado > 0;
+        if (record->nif < nifMin || record->nif > nifMax || (liveOnly && !isLive) ||
+                (voo && strncmp(record->nrVoo, voo, sizeof(record->nrVoo))))
+            continue;
+        live += isLive;
+        if (!countOnly) {
+            if (outputLength > DUMP_BUFFER_SIZE - DUMP_RECORD_MAX)
+                flushOutput();
+            putRecord(record, format, matched == 0);
+        }
+        matched++;
+    }
+
+    if (countOnly)
+        outputLength = sprintf(output, "%ld registos (%ld com sessão aberta) de %zu\n", matched, live, count);
+    else if (format == FORMAT_JSON)
+        putText(matched ? "\n]\n" : "]\n");
+    flushOutput();
+    return 0;
+}
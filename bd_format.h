@@ -0,0 +1,157 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_format.h
+ ** Descrição/Explicação do Módulo:
+ **     Formato do ficheiro da BD. O formato original (legado) é um vetor de registos
+ **     CheckIn sem cabeçalho. Os restantes começam com um BdHeader, que descreve o
+ **     layout (vetor de CheckIn, ou colunar), o tamanho de cada registo, se a BD está
+ **     ordenada e onde está o seu índice, se for embutido. O formato colunar guarda
+ **     cada campo numa coluna contígua (nif[], senha[], nome[], nrVoo[], pidCliente[],
+ **     pidServidorDedicado[]), para que a pesquisa por NIF só percorra 4 bytes por
+ **     registo em vez de 120. Como BD_MAGIC, lido como NIF, é maior do que
+ **     999999999, um ficheiro com cabeçalho nunca é confundido com um legado.
+ **
+ ******************************************************************************/
+#ifndef __BD_FORMAT_H__
+#define __BD_FORMAT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include "common.h"
+
+#define BD_MAGIC   0x44424649       // "IFBD" em little-endian (1145194057 como NIF: inválido)
+#define BD_VERSION 2                // Também são aceites ficheiros da versão 1 (sem recordSize, flags, etc.)
+
+#define BD_FLAG_SORTED 0x1          // Os primeiros sortedCount registos estão ordenados por NIF (estritamente crescente)
+
+typedef enum {
+    BD_LAYOUT_ROWS = 0,             // Vetor de CheckIn (sem cabeçalho no formato legado)
+    BD_LAYOUT_COLUMNS = 1           // Cabeçalho + uma coluna por campo de CheckIn
+} BdLayout;
+
+typedef struct {
+    uint32_t magic;                 // BD_MAGIC
+    uint16_t version;               // BD_VERSION
+    uint16_t layout;                // BdLayout
+    uint64_t count;                 // Nº de registos
+    uint32_t recordSize;            // sizeof(CheckIn) de quem escreveu o ficheiro (depende do padding do compilador)
+    uint32_t flags;                 // BD_FLAG_*
+    uint64_t indexOffset;           // Posição do índice embutido no ficheiro (ver bd_index.h), ou 0 se não existir
+    uint64_t checksum;              // FNV-1a dos restantes bytes do cabeçalho (com checksum a 0)
+    uint64_t sortedCount;           // Com BD_FLAG_SORTED: nº de registos ordenados; os seguintes foram acrescentados depois
+    uint8_t  reserved[16];          // Para versões futuras (a zeros)
+} BdHeader;
+
+_Static_assert(sizeof(BdHeader) == 64, "BdHeader ocupa 64 bytes, para as colunas ficarem alinhadas");
+
+/* Colunas do formato colunar, pela ordem em que estão no ficheiro */
+typedef enum { BD_COL_NIF, BD_COL_SENHA, BD_COL_NOME, BD_COL_NRVOO, BD_COL_PID_CLIENTE, BD_COL_PID_SERVIDOR, BD_COLUMNS } BdColumn;
+
+static const size_t bdColumnWidth[BD_COLUMNS] = {
+    sizeof(((CheckIn *) 0)->nif), sizeof(((CheckIn *) 0)->senha), sizeof(((CheckIn *) 0)->nome),
+    sizeof(((CheckIn *) 0)->nrVoo), sizeof(((CheckIn *) 0)->pidCliente), sizeof(((CheckIn *) 0)->pidServidorDedicado)
+};
+
+/**
+ * @brief Posição no ficheiro da coluna column de uma BD colunar com count registos
+ */
+static inline off_t bdColumnOffset (uint64_t count, BdColumn column) {
+    off_t offset = sizeof(BdHeader);
+    for (int c = 0; c < (int) column; c++)
+        offset += bdColumnWidth[c] * count;
+    return offset;
+}
+
+/**
+ * @brief Posição no ficheiro do registo i de uma BD com layout BD_LAYOUT_ROWS (com ou sem cabeçalho)
+ */
+static inline off_t bdRecordOffset (const BdHeader *header, uint64_t i) {
+    return (header->magic == BD_MAGIC ? sizeof(BdHeader) : 0) + i * sizeof(CheckIn);
+}
+
+/**
+ * @brief Posição no ficheiro do campo column do registo i, em qualquer dos layouts
+ */
+static inline off_t bdFieldOffset (const BdHeader *header, uint64_t i, BdColumn column) {
+    static const size_t rowOffset[BD_COLUMNS] = {
+        offsetof(CheckIn, nif), offsetof(CheckIn, senha), offsetof(CheckIn, nome),
+        offsetof(CheckIn, nrVoo), offsetof(CheckIn, pidCliente), offsetof(CheckIn, pidServidorDedicado)
+    };
+    if (header->layout == BD_LAYOUT_COLUMNS)
+        return bdColumnOffset(header->count, column) + i * bdColumnWidth[column];
+    return bdRecordOffset(header, i) + rowOffset[column];
+}
+
+/**
+ * @brief Fim dos dados da BD (os dois layouts ocupam o mesmo espaço); um índice embutido fica a seguir
+ */
+static inline off_t bdDataEnd (const BdHeader *header) {
+    return bdRecordOffset(header, header->count);
+}
+
+/**
+ * @brief Checksum (FNV-1a de 64 bits) do cabeçalho, calculado com o campo checksum a 0
+ */
+static inline uint64_t bdHeaderChecksum (const BdHeader *header) {
+    BdHeader copy = *header;
+    const uint8_t *bytes = (const uint8_t *) &copy;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    copy.checksum = 0;
+    for (size_t i = 0; i < sizeof(BdHeader); i++)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+/**
+ * @brief Cabeçalho da versão atual para uma BD com count registos
+ */
+static inline BdHeader bdHeaderInit (BdLayout layout, uint64_t count, uint32_t flags) {
+    return (BdHeader) { .magic = BD_MAGIC, .version = BD_VERSION, .layout = layout, .count = count,
+                        .recordSize = sizeof(CheckIn), .flags = flags, .indexOffset = 0 };
+}
+
+/**
+ * @brief Escreve o cabeçalho (da versão atual, com o checksum atualizado) no início da BD aberta em fd
+ * @return int 0 em caso de sucesso, -1 em caso de erro
+ */
+static inline int bdHeaderWrite (int fd, BdHeader *header) {
+    header->version = BD_VERSION;
+    header->recordSize = sizeof(CheckIn);
+    header->checksum = bdHeaderChecksum(header);
+    return pwrite(fd, header, sizeof(BdHeader), 0) == sizeof(BdHeader) ? 0 : -1;
+}
+
+/**
+ * @brief Lê e valida o cabeçalho da BD aberta em fd. Se o ficheiro não tiver cabeçalho (formato legado),
+ *        preenche header com BD_LAYOUT_ROWS e o nº de registos deduzido do tamanho do ficheiro.
+ *        Os campos da versão 2 de um cabeçalho da versão 1 ficam a 0 (sem flags nem índice embutido)
+ * @param fileSize O tamanho do ficheiro
+ * @return int     0 em caso de sucesso, -1 se o cabeçalho for inválido
+ */
+static inline int bdHeaderRead (int fd, off_t fileSize, BdHeader *header) {
+    memset(header, 0, sizeof(BdHeader));
+    if (fileSize < (off_t) sizeof(uint32_t) || pread(fd, header, sizeof(BdHeader), 0) < (ssize_t) sizeof(uint32_t) ||
+            header->magic != BD_MAGIC) {
+        *header = (BdHeader) { .magic = 0, .version = 0, .layout = BD_LAYOUT_ROWS, .count = fileSize / sizeof(CheckIn),
+                               .recordSize = sizeof(CheckIn) };
+        return 0;
+    }
+    if (fileSize < (off_t) sizeof(BdHeader) || header->version < 1 || header->version > BD_VERSION)
+        return -1;
+    if (header->version == 1) {     // A versão 1 só tinha o layout colunar e os campos até count
+        if (header->layout != BD_LAYOUT_COLUMNS)
+            return -1;
+        memset((char *) header + offsetof(BdHeader, recordSize), 0, sizeof(BdHeader) - offsetof(BdHeader, recordSize));
+        header->recordSize = sizeof(CheckIn);
+    } else if (header->checksum != bdHeaderChecksum(header) || header->recordSize != sizeof(CheckIn) ||
+               (header->layout != BD_LAYOUT_ROWS && header->layout != BD_LAYOUT_COLUMNS) || header->sortedCount > header->count ||
+               (header->indexOffset && (header->indexOffset < (uint64_t) bdDataEnd(header) || header->indexOffset >= (uint64_t) fileSize)))
+        return -1;
+    if (bdDataEnd(header) > fileSize)
+        return -1;
+    return 0;
+}
+
+#endif  // __BD_FORMAT_H__
@@ -0,0 +1,186 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_generate.c
+ ** Descrição/Explicação do Módulo:
+ **     Ferramenta que gera uma BD sintética (FILE_DATABASE) com N passageiros, para
+ **     testes de escala. Os NIFs são válidos (com dígito de controlo), distintos e
+ **     começam preferencialmente por 2, 1 e 3 (pessoas singulares); os NIFs são
+ **     escolhidos por uma permutação pseudo-aleatória (rede de Feistel), pelo que
+ **     não é preciso guardar os já usados. A mesma semente gera sempre a mesma BD.
+ **     Opcionalmente escreve também os pares "nif senha" (para o loadgen).
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include <getopt.h>
+#include <stdint.h>
+
+#define GENERATE_BUFFER_RECORDS 32768        // Registos escritos em cada write() (~3.75 MB)
+#define GENERATE_NIF_BLOCK      10000000     // NIFs (sem dígito de controlo) por primeiro algarismo
+#define GENERATE_FAKE_PID_MIN   4194305      // Acima de PID_MAX_LIMIT (2^22): nunca é o PID de um processo
+
+static const int nifPrefixes[] = { 2, 1, 3, 5, 6, 9, 8, 7, 4 };  // Por ordem de frequência desejada
+static const char *firstNames[] = {
+    "Ana", "Maria", "Joana", "Beatriz", "Mariana", "Ines", "Sofia", "Rita", "Catarina", "Carolina",
+    "Joao", "Pedro", "Tiago", "Rui", "Miguel", "Nuno", "David", "Fabio", "Andre", "Goncalo"
+};
+static const char *lastNames[] = {
+    "Silva", "Santos", "Ferreira", "Pereira", "Oliveira", "Costa", "Rodrigues", "Martins", "Sousa", "Fernandes",
+    "Goncalves", "Gomes", "Lopes", "Marques", "Alves", "Almeida", "Ribeiro", "Pinto", "Carvalho", "Teixeira",
+    "Cardoso", "Garrido", "Pinheiro", "Gabriel"
+};
+static const char *airlines[] = { "TP", "FR", "U2", "PR", "LH", "IB", "VY", "AF" };
+static const char passwordChars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+/**
+ * @brief Gerador pseudo-aleatório (xorshift64*), determinístico para a mesma semente
+ */
+static uint64_t nextRandom (uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @brief Permutação pseudo-aleatória de [0, domain): rede de Feistel de 4 voltas sobre 2 * halfBits bits,
+ *        repetida até o resultado cair dentro do domínio (cycle walking)
+ */
+static uint64_t permute (uint64_t value, uint64_t domain, int halfBits, const uint64_t keys[4]) {
+    uint64_t mask = (1ULL << halfBits) - 1;
+    do {
+        uint64_t left = value >> halfBits, right = value & mask;
+        for (int round = 0; round < 4; round++) {
+            uint64_t mixed = (right ^ keys[round]) * 0x9E3779B97F4A7C15ULL;
+            uint64_t next = left ^ ((mixed >> 29) & mask);
+            left = right;
+            right = next;
+        }
+        value = (left << halfBits) | right;
+    } while (value >= domain);
+    return value;
+}
+
+/**
+ * @brief NIF válido a partir dos 8 primeiros algarismos, acrescentando o dígito de controlo (módulo 11)
+ */
+static int nifWithCheckDigit (int base) {
+    int sum = 0, digits = base;
+    for (int weight = 2; weight <= 9; weight++, digits /= 10)
+        sum += (digits % 10) * weight;
+    int check = 11 - sum % 11;
+    return base * 10 + (check >= 10 ? 0 : check);
+}
+
+int main (int argc, char *argv[]) {
+    static struct option options[] = {
+        { "records", required_argument, NULL, 'n' },
+        { "seed", required_argument, NULL, 's' },
+        { "flights", required_argument, NULL, 'f' },
+        { "live", required_argument, NULL, 'l' },
+        { "pairs", required_argument, NULL, 'p' },
+        { NULL, 0, NULL, 0 }
+    };
+    long nRecords = 1000, nFlights = 200;
+    double livePercent = 0;
+    uint64_t seed = 1;
+    char *namePairs = NULL;
+    int option;
+
+    while ((option = getopt_long(argc, argv, "n:s:f:l:p:", options, NULL)) != -1) {
+        switch (option) {
+            case 'n': nRecords = atol(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 'f': nFlights = atol(optarg); break;
+            case 'l': livePercent = atof(optarg); break;
+            case 'p': namePairs = optarg; break;
+            default:
+                printf("Uso: %s [opções] [<binary-file.dat>]\n"
+                       "  -n, --records N         Nº de passageiros (por omissão 1000; máximo %d)\n"
+                       "  -s, --seed S            Semente do gerador (a mesma semente gera a mesma BD)\n"
+                       "  -f, --flights F         Nº de voos distintos (por omissão 200)\n"
+                       "  -l, --live P            Percentagem de registos com sessão aberta (PIDs fictícios, > %d)\n"
+                       "  -p, --pairs FICHEIRO    Escreve também os pares \"nif senha\" (e.g., para o loadgen)\n",
+                       argv[0], (int) COUNT(nifPrefixes) * GENERATE_NIF_BLOCK, GENERATE_FAKE_PID_MIN - 1);
+                exit(1);
+        }
+    }
+    char *nameDB = optind < argc ? argv[optind] : FILE_DATABASE;
+    if (nRecords <= 0 || nRecords > (long) COUNT(nifPrefixes) * GENERATE_NIF_BLOCK || nFlights <= 0 ||
+            livePercent < 0 || livePercent > 100) {
+        so_error("GEN", "Valores inválidos");
+        exit(1);
+    }
+
+    // Usa só os primeiros algarismos necessários para que, no máximo, metade dos NIFs possíveis seja usada
+    int nPrefixes = 1;
+    while (nPrefixes < (int) COUNT(nifPrefixes) && (long) nPrefixes * GENERATE_NIF_BLOCK < 2 * nRecords)
+        nPrefixes++;
+    uint64_t domain = (uint64_t) nPrefixes * GENERATE_NIF_BLOCK, state = seed * 0x9E3779B97F4A7C15ULL + 1, keys[4];
+    int halfBits = 1;
+    while ((1ULL << (2 * halfBits)) < domain)
+        halfBits++;
+    for (int i = 0; i < 4; i++)
+        keys[i] = nextRandom(&state);
+
+    // Os voos são gerados uma única vez, para que vários passageiros partilhem o mesmo voo
+    char (*flights)[8] = malloc(nFlights * sizeof(*flights));
+    CheckIn *buffer = malloc(GENERATE_BUFFER_RECORDS * sizeof(CheckIn));
+    int fd = open(nameDB, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FILE *filePairs = namePairs ? fopen(namePairs, "w") : NULL;
+    if (!flights || !buffer || fd == -1 || (namePairs && !filePairs)) {
+        so_error("GEN", "Erro ao criar %s", fd == -1 ? nameDB : namePairs ? namePairs : "");
+        exit(1);
+    }
+    if (filePairs)
+        setvbuf(filePairs, NULL, _IOFBF, 1 << 20);
+    for (long i = 0; i < nFlights; i++)
+        snprintf(flights[i], sizeof(flights[i]), "%s%04d", airlines[nextRandom(&state) % COUNT(airlines)],
+                 (int) (nextRandom(&state) % 10000));
+
+    for (long written = 0; written < nRecords; ) {
+        int n = nRecords - written < GENERATE_BUFFER_RECORDS ? nRecords - written : GENERATE_BUFFER_RECORDS;
+        memset(buffer, 0, n * sizeof(CheckIn));
+        for (int i = 0; i < n; i++) {
+            CheckIn *record = &buffer[i];
+            uint64_t slot = permute(written + i, domain, halfBits, keys);
+            record->nif = nifWithCheckDigit(nifPrefixes[slot / GENERATE_NIF_BLOCK] * GENERATE_NIF_BLOCK + slot % GENERATE_NIF_BLOCK);
+
+            int length = 8 + nextRandom(&state) % 5;
+            for (int c = 0; c < length; c++)
+                record->senha[c] = passwordChars[nextRandom(&state) % (sizeof(passwordChars) - 1)];
+            snprintf(record->nome, sizeof(record->nome), "%s %s", firstNames[nextRandom(&state) % COUNT(firstNames)],
+                     lastNames[nextRandom(&state) % COUNT(lastNames)]);
+            memcpy(record->nrVoo, flights[nextRandom(&state) % nFlights], sizeof(record->nrVoo));
+
+            record->pidCliente = record->pidServidorDedicado = -1;
+            if (livePercent > 0 && (nextRandom(&state) % 1000000) < livePercent * 10000) {
+                record->pidCliente = GENERATE_FAKE_PID_MIN + nextRandom(&state) % (INT32_MAX - GENERATE_FAKE_PID_MIN);
+                record->pidServidorDedicado = GENERATE_FAKE_PID_MIN + nextRandom(&state) % (INT32_MAX - GENERATE_FAKE_PID_MIN);
+            }
+            if (filePairs)
+                fprintf(filePairs, "%d %s\n", record->nif, record->senha);
+        }
+
+        ssize_t size = n * sizeof(CheckIn), done = 0, bytesWritten;
+        while (done < size && ((bytesWritten = write(fd, (char *) buffer + done, size - done)) > 0 || errno == EINTR))
+            if (bytesWritten > 0)
+                done += bytesWritten;
+        if (done < size) {
+            so_error("GEN", "Erro ao escrever %s", nameDB);
+            exit(1);
+        }
+        written += n;
+    }
+
+    if (close(fd) == -1 || (filePairs && fclose(filePairs) != 0)) {
+        so_error("GEN", "Erro ao fechar os ficheiros");
+        exit(1);
+    }
+    so_success("GEN", "%s: %ld passageiros, %ld voos (semente %llu)", nameDB, nRecords, nFlights, (unsigned long long) seed);
+    return 0;
+}
@@ -0,0 +1,316 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_index.c
+ ** Descrição/Explicação do Módulo:
+ **     Implementação do índice de hash da BD (ver bd_index.h). A tabela usa
+ **     endereçamento aberto com sondagem linear, e é lida/escrita diretamente no
+ **     ficheiro com pread()/pwrite(), pelo que cada pesquisa custa O(1) acessos.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include "bd_index.h"
+#include "bd_format.h"
+#include <limits.h>
+
+#define BD_INDEX_PROBE_BLOCK 8       // Nº de entradas lidas de cada vez durante a sondagem (64 bytes)
+#define BD_INDEX_BUILD_CHUNK 4096    // Nº de registos da BD lidos de cada vez durante a reconstrução
+
+/**
+ * @brief Posição inicial da sondagem de um NIF (hashing de Fibonacci)
+ */
+static uint32_t bdIndexHash (int nif, uint32_t nSlots) {
+    return ((uint32_t) nif * 2654435769u) >> (32 - __builtin_ctz(nSlots));
+}
+
+/**
+ * @brief Posição (em bytes) da entrada slot no ficheiro de índice
+ */
+static off_t bdIndexSlotOffset (const BdIndex *index, uint32_t slot) {
+    return index->base + sizeof(BdIndexHeader) + (off_t) slot * sizeof(BdIndexSlot);
+}
+
+/**
+ * @brief Bloqueia (F_WRLCK) ou desbloqueia (F_UNLCK) todo o índice. Se for embutido, só a zona a seguir
+ *        aos dados, que não se sobrepõe aos locks dos registos
+ */
+static int bdIndexLock (BdIndex *index, short type) {
+    struct flock lock = { .l_type = type, .l_whence = SEEK_SET, .l_start = index->base, .l_len = 0 };
+    return fcntl(index->fd, F_SETLKW, &lock);
+}
+
+/**
+ * @brief Constrói o nome do ficheiro de índice de uma BD (i.e., nameDB + FILE_SUFFIX_INDEX)
+ * @param nameDB O nome da base de dados
+ * @param buffer Onde escrever o nome do índice
+ * @param size   Tamanho de buffer
+ */
+void bdIndexName (const char *nameDB, char *buffer, size_t size) {
+    snprintf(buffer, size, "%s%s", nameDB, FILE_SUFFIX_INDEX);
+}
+
+/**
+ * @brief Abre o índice embutido na BD, se o seu cabeçalho tiver um (BdHeader.indexOffset)
+ * @return int 0 em caso de sucesso, -1 se não houver índice embutido
+ */
+static int bdIndexOpenEmbedded (BdIndex *index, const char *nameDB, int writable) {
+    struct stat statDB;
+    BdHeader headerDB;
+    index->fd = open(nameDB, writable ? O_RDWR : O_RDONLY);
+    if (index->fd != -1 && fstat(index->fd, &statDB) == 0 && bdHeaderRead(index->fd, statDB.st_size, &headerDB) == 0 &&
+            headerDB.indexOffset) {
+        index->base = headerDB.indexOffset;
+        return 0;
+    }
+    bdIndexClose(index);
+    return -1;
+}
+
+/**
+ * @brief Abre o índice de uma BD e valida o seu cabeçalho. O ficheiro nameDB FILE_SUFFIX_INDEX tem
+ *        prioridade; só se não existir é procurado um índice embutido na BD
+ * @param index    A estrutura a preencher
+ * @param nameDB   O nome da base de dados
+ * @param writable TRUE se o índice vai ser atualizado
+ * @return int     0 em caso de sucesso, -1 se o índice não existir ou for inválido
+ */
+int bdIndexOpen (BdIndex *index, const char *nameDB, int writable) {
+    char nameIndex[PATH_MAX];
+    so_debug("< [@param nameDB:%s, writable:%d]", nameDB, writable);
+
+    bdIndexName(nameDB, nameIndex, sizeof(nameIndex));
+    index->base = 0;
+    index->fd = open(nameIndex, writable ? O_RDWR : O_RDONLY);
+    if (index->fd == -1 && (errno != ENOENT || bdIndexOpenEmbedded(index, nameDB, writable) == -1))
+        return -1;                          // Não há índice: quem chama faz a pesquisa sequencial
+
+    if (pread(index->fd, &index->header, sizeof(BdIndexHeader), index->base) != sizeof(BdIndexHeader) ||
+            index->header.magic != BD_INDEX_MAGIC || index->header.version != BD_INDEX_VERSION ||
+            index->header.nSlots == 0 || (index->header.nSlots & (index->header.nSlots - 1))) {
+        so_error("IDX", "Índice %s inválido, deve ser reconstruído", nameIndex);
+        bdIndexClose(index);
+        return -1;
+    }
+
+    so_debug("> [nSlots:%u, nEntries:%u]", index->header.nSlots, index->header.nEntries);
+    return 0;
+}
+
+/**
+ * @brief Fecha o índice
+ */
+void bdIndexClose (BdIndex *index) {
+    if (index->fd != -1)
+        close(index->fd);
+    index->fd = -1;
+}
+
+/**
+ * @brief Sondagem linear da entrada de um NIF, lendo BD_INDEX_PROBE_BLOCK entradas por pread()
+ * @param entry Preenchida com a entrada encontrada (com o NIF, ou livre)
+ * @return long A posição (slot) do NIF, ou da entrada livre onde deveria ser inserido; -1 em erro
+ */
+static long bdIndexProbe (BdIndex *index, int nif, BdIndexSlot *entry) {
+    BdIndexSlot block[BD_INDEX_PROBE_BLOCK];
+    uint32_t mask = index->header.nSlots - 1;
+    uint32_t slot = bdIndexHash(nif, index->header.nSlots);
+    uint32_t probed = 0;
+
+    while (probed < index->header.nSlots) {
+        uint32_t n = BD_INDEX_PROBE_BLOCK;
+        if (slot + n > index->header.nSlots)
+            n = index->header.nSlots - slot;  // Não ultrapassa o fim da tabela; a sondagem dá a volta
+        ssize_t bytesRead = pread(index->fd, block, n * sizeof(BdIndexSlot), bdIndexSlotOffset(index, slot));
+        if (bytesRead != (ssize_t) (n * sizeof(BdIndexSlot)))
+            return -1;
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (block[i].nif == nif || block[i].nif == 0) {
+                *entry = block[i];
+                return slot + i;
+            }
+        }
+        probed += n;
+        slot = (slot + n) & mask;
+    }
+    return -1;                              // Tabela cheia e NIF ausente
+}
+
+/**
+ * @brief Pesquisa O(1) do índice do registo de um NIF
+ * @param index O índice aberto com bdIndexOpen()
+ * @param nif   O NIF a procurar
+ * @return int  O índice do registo na BD, ou -1 se o NIF não constar do índice
+ */
+int bdIndexLookup (BdIndex *index, int nif) {
+    BdIndexSlot entry;
+    if (nif <= 0 || bdIndexProbe(index, nif, &entry) < 0 || entry.nif != nif)
+        return -1;
+    return entry.index;
+}
+
+/**
+ * @brief Insere (ou corrige) a entrada de um NIF. O ficheiro é bloqueado durante a atualização,
+ *        pois vários Servidores Dedicados podem atualizar o índice ao mesmo tempo
+ * @param index       O índice aberto com bdIndexOpen(..., TRUE)
+ * @param nif         O NIF do passageiro
+ * @param indexClient O índice do registo na BD
+ * @return int        0 em caso de sucesso, -1 em caso de erro ou se o índice estiver demasiado cheio
+ */
+int bdIndexInsert (BdIndex *index, int nif, int indexClient) {
+    BdIndexSlot entry = { .nif = nif, .index = indexClient }, current;
+    int result = -1;
+    so_debug("< [@param nif:%d, indexClient:%d]", nif, indexClient);
+
+    if (nif <= 0 || bdIndexLock(index, F_WRLCK) == -1)
+        return -1;
+
+    // Relê o cabeçalho, já que outro processo pode ter inserido entradas entretanto
+    if (pread(index->fd, &index->header, sizeof(BdIndexHeader), index->base) == sizeof(BdIndexHeader)) {
+        long slot = bdIndexProbe(index, nif, &current);
+        if (slot >= 0 && current.nif == nif) {
+            if (current.index == indexClient ||
+                    pwrite(index->fd, &entry, sizeof(entry), bdIndexSlotOffset(index, slot)) == sizeof(entry))
+                result = 0;
+        } else if (slot >= 0 && (uint64_t) (index->header.nEntries + 1) * 100 <= (uint64_t) index->header.nSlots * BD_INDEX_MAX_LOAD) {
+            index->header.nEntries++;
+            if (pwrite(index->fd, &entry, sizeof(entry), bdIndexSlotOffset(index, slot)) == sizeof(entry) &&
+                    pwrite(index->fd, &index->header, sizeof(BdIndexHeader), index->base) == sizeof(BdIndexHeader))
+                result = 0;
+        } else {
+            so_error("IDX", "Índice cheio, deve ser reconstruído");
+        }
+    }
+
+    bdIndexLock(index, F_UNLCK);
+    so_debug("> [@return:%d]", result);
+    return result;
+}
+
+/**
+ * @brief Escreve o índice no fim da BD, a seguir aos dados, e atualiza BdHeader.indexOffset. Ao contrário
+ *        do índice num ficheiro à parte, não é atómico: só deve ser usado com o Servidor parado
+ * @return int 0 em caso de sucesso, -1 em caso de erro
+ */
+static int bdIndexWriteEmbedded (const char *nameDB, BdHeader *headerDB, const BdIndexHeader *header, const BdIndexSlot *slots) {
+    char nameIndex[PATH_MAX];
+    off_t base = bdDataEnd(headerDB);
+    size_t size = header->nSlots * sizeof(BdIndexSlot);
+    int fd = open(nameDB, O_RDWR);
+    int ok = fd != -1 && ftruncate(fd, base) == 0 &&
+             pwrite(fd, header, sizeof(BdIndexHeader), base) == sizeof(BdIndexHeader) &&
+             pwrite(fd, slots, size, base + sizeof(BdIndexHeader)) == (ssize_t) size;
+    headerDB->indexOffset = base;
+    if (ok)
+        ok = bdHeaderWrite(fd, headerDB) == 0;
+    if (fd != -1 && close(fd) == -1)
+        ok = FALSE;
+    if (!ok)
+        return -1;
+    bdIndexName(nameDB, nameIndex, sizeof(nameIndex));
+    unlink(nameIndex);                      // Senão teria prioridade sobre o índice embutido
+    return 0;
+}
+
+/**
+ * @brief Regenera o índice a partir da BD. A tabela é construída em memória, escrita num
+ *        ficheiro temporário e depois renomeada, para que os leitores nunca vejam um índice parcial.
+ *        Se um NIF estiver repetido, fica o primeiro registo (tal como na pesquisa sequencial)
+ * @param nameDB O nome da base de dados
+ * @param embed  TRUE para embutir o índice na BD (só numa BD com cabeçalho); um índice já embutido
+ *               é sempre regenerado no mesmo sítio
+ * @return long  O nº de entradas do índice, ou -1 em caso de erro
+ */
+long bdIndexBuild (const char *nameDB, int embed) {
+    char nameIndex[PATH_MAX], nameTemp[PATH_MAX + 8];
+    struct stat statDB;
+    BdHeader headerDB;
+    so_debug("< [@param nameDB:%s, embed:%d]", nameDB, embed);
+
+    FILE *dbFile = fopen(nameDB, "rb");
+    if (!dbFile || fstat(fileno(dbFile), &statDB) == -1 || bdHeaderRead(fileno(dbFile), statDB.st_size, &headerDB) == -1) {
+        so_error("IDX", "Erro ao abrir %s", nameDB);
+        if (dbFile)
+            fclose(dbFile);
+        return -1;
+    }
+    embed = embed || headerDB.indexOffset;
+    if (embed && headerDB.magic != BD_MAGIC) {
+        so_error("IDX", "%s não tem cabeçalho, não pode ter um índice embutido (ver bd_convert)", nameDB);
+        fclose(dbFile);
+        return -1;
+    }
+
+    uint64_t nRecords = headerDB.count;
+    BdIndexHeader header = { .magic = BD_INDEX_MAGIC, .version = BD_INDEX_VERSION, .nSlots = BD_INDEX_MIN_SLOTS,
+                             .nEntries = 0, .nRecords = nRecords };
+    while (header.nSlots < 2 * nRecords)    // Ocupação máxima de 50% após a reconstrução
+        header.nSlots <<= 1;
+
+    BdIndexSlot *slots = calloc(header.nSlots, sizeof(BdIndexSlot));
+    CheckIn *chunk = malloc(BD_INDEX_BUILD_CHUNK * sizeof(CheckIn));
+    int32_t *nifs = (int32_t *) chunk;      // No layout colunar só é lida a coluna nif
+    if (!slots || !chunk) {
+        so_error("IDX", "Sem memória para %u entradas", header.nSlots);
+        free(slots);
+        free(chunk);
+        fclose(dbFile);
+        return -1;
+    }
+
+    int32_t indexClient = 0;
+    size_t n;
+    fseeko(dbFile, headerDB.layout == BD_LAYOUT_COLUMNS ? bdColumnOffset(headerDB.count, BD_COL_NIF) : bdRecordOffset(&headerDB, 0), SEEK_SET);
+    while (indexClient < (int64_t) nRecords &&
+           (n = headerDB.layout == BD_LAYOUT_COLUMNS ? fread(nifs, sizeof(int32_t), BD_INDEX_BUILD_CHUNK, dbFile)
+                                                     : fread(chunk, sizeof(CheckIn), BD_INDEX_BUILD_CHUNK, dbFile)) > 0) {
+        if (n > nRecords - indexClient)
+            n = nRecords - indexClient;     // Não lê a coluna seguinte, nem um índice embutido
+        for (size_t i = 0; i < n; i++, indexClient++) {
+            int nif = headerDB.layout == BD_LAYOUT_COLUMNS ? nifs[i] : chunk[i].nif;
+            if (nif <= 0)
+                continue;
+            uint32_t slot = bdIndexHash(nif, header.nSlots);
+            while (slots[slot].nif != 0 && slots[slot].nif != nif)
+                slot = (slot + 1) & (header.nSlots - 1);
+            if (slots[slot].nif == 0) {
+                slots[slot] = (BdIndexSlot) { .nif = nif, .index = indexClient };
+                header.nEntries++;
+            }
+        }
+    }
+    fclose(dbFile);
+    free(chunk);
+
+    if (embed) {
+        int result = bdIndexWriteEmbedded(nameDB, &headerDB, &header, slots);
+        free(slots);
+        if (result == -1) {
+            so_error("IDX", "Erro ao escrever o índice em %s", nameDB);
+            return -1;
+        }
+        so_debug("> [@return:%u]", header.nEntries);
+        return header.nEntries;
+    }
+
+    bdIndexName(nameDB, nameIndex, sizeof(nameIndex));
+    snprintf(nameTemp, sizeof(nameTemp), "%s.tmp", nameIndex);
+    FILE *indexFile = fopen(nameTemp, "wb");
+    int ok = indexFile &&
+             fwrite(&header, sizeof(header), 1, indexFile) == 1 &&
+             fwrite(slots, sizeof(BdIndexSlot), header.nSlots, indexFile) == header.nSlots;
+    if (indexFile && fclose(indexFile) != 0)
+        ok = FALSE;
+    free(slots);
+
+    if (!ok || rename(nameTemp, nameIndex) == -1) {
+        so_error("IDX", "Erro ao escrever %s", nameIndex);
+        unlink(nameTemp);
+        return -1;
+    }
+
+    so_debug("> [@return:%u]", header.nEntries);
+    return header.nEntries;
+}
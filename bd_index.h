@@ -0,0 +1,51 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_index.h
+ ** Descrição/Explicação do Módulo:
+ **     Índice de hash (endereçamento aberto) guardado num ficheiro ao lado da BD,
+ **     que associa cada CheckIn.nif ao índice do respetivo registo no FILE_DATABASE.
+ **     Numa BD com cabeçalho, o índice pode também ficar embutido no próprio ficheiro,
+ **     a seguir aos dados (BdHeader.indexOffset, ver bd_format.h)
+ **
+ ******************************************************************************/
+#ifndef __BD_INDEX_H__
+#define __BD_INDEX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define FILE_SUFFIX_INDEX  ".idx"       // Sufixo do ficheiro de índice (e.g., bd_passageiros.dat.idx)
+#define BD_INDEX_MAGIC     0x58444946   // "FIDX" em little-endian
+#define BD_INDEX_VERSION   1
+#define BD_INDEX_MIN_SLOTS 1024         // Nº mínimo de entradas da tabela (potência de 2)
+#define BD_INDEX_MAX_LOAD  75           // Taxa de ocupação máxima (%) antes de ser necessário reconstruir
+
+typedef struct {
+    uint32_t magic;             // BD_INDEX_MAGIC
+    uint32_t version;           // BD_INDEX_VERSION
+    uint32_t nSlots;            // Nº de entradas da tabela (sempre potência de 2)
+    uint32_t nEntries;          // Nº de entradas ocupadas
+    uint64_t nRecords;          // Nº de registos da BD quando o índice foi construído
+} BdIndexHeader;
+
+typedef struct {
+    int32_t nif;                // NIF do passageiro (0 = entrada livre)
+    int32_t index;              // Índice do registo na BD
+} BdIndexSlot;
+
+typedef struct {
+    int fd;                     // Descritor do ficheiro de índice, ou da BD se for embutido (-1 se não existir)
+    off_t base;                 // Posição do índice no ficheiro (0, ou BdHeader.indexOffset se for embutido)
+    BdIndexHeader header;       // Cabeçalho lido na abertura
+} BdIndex;
+
+void bdIndexName (const char *, char *, size_t);  // Nome do ficheiro de índice de uma BD
+int  bdIndexOpen (BdIndex *, const char *, int);  // Abre o índice da BD (0 = sucesso, -1 = sem índice)
+void bdIndexClose (BdIndex *);                    // Fecha o índice
+int  bdIndexLookup (BdIndex *, int);              // Índice do registo com o NIF dado, ou -1
+int  bdIndexInsert (BdIndex *, int, int);         // Insere/atualiza a entrada de um NIF (0 = sucesso)
+long bdIndexBuild (const char *, int);            // Regenera o índice (embutido se TRUE) a partir da BD (nº de entradas, ou -1)
+
+#endif  // __BD_INDEX_H__
@@ -0,0 +1,222 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_journal.c
+ ** Descrição/Explicação do Módulo:
+ **     Implementação do diário das sessões (ver bd_journal.h). As entradas são
+ **     acrescentadas com O_APPEND, cada uma com um único write() de 32 bytes. Quem
+ **     pede um commit recebe uma senha (ticket) depois de a sua entrada estar escrita,
+ **     pelo que qualquer fdatasync() que comece depois disso a cobre: o primeiro a
+ **     chegar torna-se líder e faz o sync de todas as senhas já distribuídas, e os
+ **     restantes esperam num futex em memória partilhada pelo fim desse sync.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include "bd_journal.h"
+#include "procutil.h"
+#include <sys/mman.h>
+
+typedef struct {
+    atomic_ulong requested;          // Senhas distribuídas: entradas já escritas que pediram commit
+    atomic_ulong durable;            // Senhas cobertas por um fdatasync() já concluído
+    atomic_int   leader;             // PID do processo que está a fazer o fdatasync() (0 = nenhum)
+    atomic_uint  wake;               // Futex: incrementado no fim de cada fdatasync()
+    atomic_long  entries;            // Estatísticas mostradas em S6
+    atomic_long  commits;
+    atomic_long  syncs;
+} BdJournalShared;
+
+static char journalName[PATH_MAX];
+static int journalFd = -1;           // Aberto no passo S1 e herdado pelos Servidores Dedicados (-1 sem --journal)
+static BdJournalShared *journalShared;
+static _Thread_local uint64_t journalTicket; // A senha da última entrada escrita por este processo (ou thread)
+
+static uint32_t bdJournalChecksum (const BdJournalEntry *entry) {
+    BdJournalEntry copy = *entry;
+    const unsigned char *bytes = (const unsigned char *) &copy;
+    uint32_t hash = 2166136261u;
+    copy.checksum = 0;
+    for (size_t i = 0; i < sizeof(copy); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * @brief Constrói o nome do diário de uma BD (i.e., nameDB + FILE_SUFFIX_JOURNAL)
+ */
+void bdJournalName (const char *nameDB, char *buffer, size_t size) {
+    snprintf(buffer, size, "%s%s", nameDB, FILE_SUFFIX_JOURNAL);
+}
+
+/**
+ * @brief Abre (ou cria) o diário da BD e a memória partilhada do group commit. Chamada pelo Servidor no passo S1,
+ *        antes de qualquer fork(), para que os Servidores Dedicados herdem ambos
+ * @param nameDB O nome da base de dados
+ * @return int   0 em caso de sucesso, -1 em caso de erro
+ */
+int bdJournalOpen (const char *nameDB) {
+    so_debug("< [@param nameDB:%s]", nameDB);
+    bdJournalName(nameDB, journalName, sizeof(journalName));
+    journalShared = mmap(NULL, sizeof(BdJournalShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (journalShared == MAP_FAILED || (journalFd = open(journalName, O_RDWR | O_CREAT | O_APPEND, 0644)) == -1) {
+        so_error("BD", "Erro ao abrir o diário %s", journalName);
+        journalShared = NULL;
+        return -1;
+    }
+    so_debug(">");
+    return 0;
+}
+
+typedef struct {
+    uint64_t index;
+    int32_t  pidServidorDedicado;
+    uint32_t position;               // Posição da entrada no diário
+} BdJournalSession;
+
+static int compareSessions (const void *a, const void *b) {
+    const BdJournalSession *x = a, *y = b;
+    if (x->index != y->index)
+        return x->index < y->index ? -1 : 1;
+    if (x->pidServidorDedicado != y->pidServidorDedicado)
+        return x->pidServidorDedicado < y->pidServidorDedicado ? -1 : 1;
+    return x->position < y->position ? -1 : x->position > y->position;
+}
+
+static int comparePositions (const void *a, const void *b) {
+    const BdJournalSession *x = a, *y = b;
+    return x->position < y->position ? -1 : x->position > y->position;
+}
+
+/**
+ * @brief Repara as sessões que o diário deixou abertas: ordena as entradas por (registo, Servidor Dedicado) e,
+ *        em cada grupo, a última entrada diz se a sessão terminou. Para cada sessão aberta, chama repair().
+ *        Depois de fdDB estar em disco, o diário é reescrito só com as sessões que continuam abertas; uma
+ *        entrada interrompida no fim do diário (checksum errado) é descartada
+ * @param fdDB    O descritor da BD, onde repair() escreve
+ * @param repair  Chamada para cada sessão aberta (ver BdJournalRepair)
+ * @param context Passado a repair()
+ * @return long   O nº de sessões abertas encontradas, ou -1 em caso de erro
+ */
+long bdJournalReplay (int fdDB, BdJournalRepair repair, void *context) {
+    struct stat statJournal;
+    char nameTemp[PATH_MAX + 8];
+    so_debug("< [@param fdDB:%d]", fdDB);
+
+    if (journalFd == -1 || fstat(journalFd, &statJournal) == -1)
+        return -1;
+    size_t count = statJournal.st_size / sizeof(BdJournalEntry), valid = 0, nKept = 0;
+    long nOpen = 0;
+    BdJournalEntry *entries = malloc(count * sizeof(BdJournalEntry) + 1);
+    BdJournalSession *sessions = malloc(count * sizeof(BdJournalSession) + 1);
+    if (!entries || !sessions || pread(journalFd, entries, count * sizeof(BdJournalEntry), 0) != (ssize_t) (count * sizeof(BdJournalEntry))) {
+        so_error("BD", "Erro ao ler o diário %s", journalName);
+        free(entries);
+        free(sessions);
+        return -1;
+    }
+    while (valid < count && entries[valid].magic == BD_JOURNAL_MAGIC && entries[valid].checksum == bdJournalChecksum(&entries[valid]))
+        valid++;
+
+    for (size_t i = 0; i < valid; i++)
+        sessions[i] = (BdJournalSession) { entries[i].index, entries[i].pidServidorDedicado, i };
+    qsort(sessions, valid, sizeof(BdJournalSession), compareSessions);
+    for (size_t i = 0; i < valid; i++) {
+        int last = i + 1 == valid || sessions[i + 1].index != sessions[i].index ||
+                   sessions[i + 1].pidServidorDedicado != sessions[i].pidServidorDedicado;
+        if (!last || entries[sessions[i].position].type != BD_JOURNAL_CHECKIN)
+            continue;
+        nOpen++;
+        if (repair(&entries[sessions[i].position], context))
+            sessions[nKept++] = sessions[i];     // O Servidor Dedicado ainda está vivo: a sessão continua no diário
+    }
+    qsort(sessions, nKept, sizeof(BdJournalSession), comparePositions);
+
+    // As reparações têm de estar em disco antes de as respetivas entradas saírem do diário
+    snprintf(nameTemp, sizeof(nameTemp), "%s.tmp", journalName);
+    int fd = -1, ok = fdatasync(fdDB) == 0 && (fd = open(nameTemp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) != -1;
+    for (size_t i = 0; ok && i < nKept; i++)
+        ok = write(fd, &entries[sessions[i].position], sizeof(BdJournalEntry)) == sizeof(BdJournalEntry);
+    if (!ok || fdatasync(fd) == -1 || rename(nameTemp, journalName) == -1) {
+        so_error("BD", "Erro ao reescrever o diário %s", journalName);
+        if (fd != -1)
+            close(fd);
+        unlink(nameTemp);
+        nOpen = -1;
+    } else {
+        close(journalFd);
+        journalFd = fd;                          // Já aberto com O_APPEND
+    }
+    free(entries);
+    free(sessions);
+    so_debug("> [valid:%zu, open:%ld, kept:%zu]", valid, nOpen, nKept);
+    return nOpen;
+}
+
+/**
+ * @brief Acrescenta uma entrada ao diário, com um único write() (O_APPEND). Não espera que esteja em disco:
+ *        para isso, usar depois bdJournalCommit()
+ * @return int 0 em caso de sucesso (ou se não houver diário), -1 em caso de erro
+ */
+int bdJournalAppend (BdJournalType type, uint64_t index, int nif, int pidCliente, int pidServidorDedicado) {
+    if (journalFd == -1)
+        return 0;
+    BdJournalEntry entry = {
+        .magic = BD_JOURNAL_MAGIC, .type = type, .index = index,
+        .nif = nif, .pidCliente = pidCliente, .pidServidorDedicado = pidServidorDedicado
+    };
+    entry.checksum = bdJournalChecksum(&entry);
+    ssize_t n;
+    while ((n = write(journalFd, &entry, sizeof(entry))) == -1 && errno == EINTR);
+    if (n != sizeof(entry))
+        return -1;
+    atomic_fetch_add(&journalShared->entries, 1);
+    journalTicket = atomic_fetch_add(&journalShared->requested, 1) + 1;  // Só depois de a entrada estar escrita
+    return 0;
+}
+
+/**
+ * @brief Espera que as entradas já escritas por este processo estejam em disco (group commit). Se ninguém estiver
+ *        a fazer o fdatasync(), este processo torna-se líder e cobre também as entradas dos outros; caso
+ *        contrário, espera pelo fim do sync em curso. Se o líder morrer a meio, outro processo toma o seu lugar
+ * @return int 0 em caso de sucesso (ou se não houver diário), -1 se o fdatasync() falhar
+ */
+int bdJournalCommit () {
+    if (journalFd == -1 || journalTicket == 0)
+        return 0;
+    atomic_fetch_add(&journalShared->commits, 1);
+    for (;;) {
+        unsigned wake = atomic_load(&journalShared->wake);     // Lido antes de durable: não perde um fim de sync
+        if (atomic_load(&journalShared->durable) >= journalTicket)
+            return 0;
+        int leader = 0;
+        if (atomic_compare_exchange_strong(&journalShared->leader, &leader, getpid())) {
+            unsigned long target = atomic_load(&journalShared->requested), durable;
+            int failed = fdatasync(journalFd);
+            if (!failed) {
+                durable = atomic_load(&journalShared->durable);
+                while (durable < target && !atomic_compare_exchange_weak(&journalShared->durable, &durable, target));
+                atomic_fetch_add(&journalShared->syncs, 1);
+            }
+            atomic_store(&journalShared->leader, 0);
+            atomic_fetch_add(&journalShared->wake, 1);
+            futexWake(&journalShared->wake, INT_MAX, FUTEX_SHARED);
+            if (failed)
+                return -1;
+        } else if (kill(leader, 0) == -1 && errno == ESRCH) {
+            atomic_compare_exchange_strong(&journalShared->leader, &leader, 0);
+        } else {
+            futexWait(&journalShared->wake, wake, BD_JOURNAL_WAIT_MS * 1000L, FUTEX_SHARED);
+        }
+    }
+}
+
+/**
+ * @brief Estatísticas do diário, partilhadas por todos os processos (-1 se não houver diário)
+ */
+void bdJournalStats (long *entries, long *commits, long *syncs) {
+    *entries = journalShared ? atomic_load(&journalShared->entries) : -1;
+    *commits = journalShared ? atomic_load(&journalShared->commits) : -1;
+    *syncs = journalShared ? atomic_load(&journalShared->syncs) : -1;
+}
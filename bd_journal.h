@@ -0,0 +1,55 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_journal.h
+ ** Descrição/Explicação do Módulo:
+ **     Diário (write-ahead) das sessões abertas na BD (--journal). Cada check-in
+ **     (SD11) acrescenta uma entrada, que tem de estar em disco antes de o registo
+ **     ser escrito, e cada fim de sessão (SD13) acrescenta outra. Os fdatasync() são
+ **     partilhados pelos Servidores Dedicados (group commit): um deles faz o sync de
+ **     todas as entradas já escritas, enquanto os outros esperam num futex. No passo
+ **     S1, as sessões que ficaram abertas (e.g., um Servidor Dedicado morto com
+ **     SIGKILL entre SD11 e SD13) são reparadas, e o diário fica só com as restantes.
+ **
+ ******************************************************************************/
+#ifndef __BD_JOURNAL_H__
+#define __BD_JOURNAL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FILE_SUFFIX_JOURNAL  ".journal"  // Sufixo do diário (e.g., bd_passageiros.dat.journal)
+#define BD_JOURNAL_MAGIC     0x4C4E524A  // "JRNL" em little-endian
+#define BD_JOURNAL_WAIT_MS   10          // Espera máxima por cada fdatasync() de outro processo
+
+typedef enum {
+    BD_JOURNAL_CHECKIN = 1,     // SD11: o registo index passa a ter os PIDs da entrada
+    BD_JOURNAL_CLOSE            // SD13: o Servidor Dedicado pidServidorDedicado terminou a sessão do registo index
+} BdJournalType;
+
+typedef struct {
+    uint32_t magic;             // BD_JOURNAL_MAGIC
+    uint32_t type;              // BdJournalType
+    uint64_t index;             // Índice do registo na BD
+    int32_t  nif;               // NIF do passageiro (só informativo)
+    int32_t  pidCliente;
+    int32_t  pidServidorDedicado;
+    uint32_t checksum;          // FNV-1a da entrada, com checksum = 0 (deteta uma escrita interrompida)
+} BdJournalEntry;
+
+_Static_assert(sizeof(BdJournalEntry) == 32, "Cada entrada do diário é escrita com um único write()");
+
+/**
+ * Chamada por bdJournalReplay() para cada sessão aberta no diário (um check-in sem fim de sessão).
+ * Deve reparar o registo, se o Servidor Dedicado já não existir, e devolver TRUE se a sessão continuar aberta
+ */
+typedef int (*BdJournalRepair) (const BdJournalEntry *entry, void *context);
+
+void bdJournalName (const char *, char *, size_t);       // Nome do diário de uma BD
+int  bdJournalOpen (const char *);                       // Abre (ou cria) o diário da BD (0 = sucesso)
+long bdJournalReplay (int, BdJournalRepair, void *);     // Repara as sessões abertas (nº de sessões abertas, ou -1)
+int  bdJournalAppend (BdJournalType, uint64_t, int, int, int); // Acrescenta uma entrada (0 = sucesso, ou sem diário)
+int  bdJournalCommit (void);                             // Espera que as entradas deste processo estejam em disco
+void bdJournalStats (long *, long *, long *);            // Nº de entradas, de commits e de fdatasync() (-1 sem diário)
+
+#endif  // __BD_JOURNAL_H__
@@ -0,0 +1,35 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_reindex.c
+ ** Descrição/Explicação do Módulo:
+ **     Ferramenta que regenera o índice de hash (FILE_DATABASE FILE_SUFFIX_INDEX)
+ **     a partir do ficheiro da BD. Deve ser usada sempre que a BD é alterada fora
+ **     do Servidor (e.g., quando são acrescentados passageiros). Com --embed, numa BD
+ **     com cabeçalho, o índice é guardado no próprio ficheiro da BD.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include "bd_index.h"
+#include <limits.h>
+
+int main (int argc, char *argv[]) {
+    int embed = argc > 1 && !strcmp(argv[1], "--embed");
+    char *nameDB = argc > 1 + embed ? argv[1 + embed] : FILE_DATABASE;
+    char nameIndex[PATH_MAX];
+
+    if (argc > 2 + embed) {
+        so_error("", "SYNTAX: %s [--embed] [<binary-file.dat>]", argv[0]);
+        exit(1);
+    }
+
+    long nEntries = bdIndexBuild(nameDB, embed);
+    if (nEntries < 0)
+        exit(1);
+
+    bdIndexName(nameDB, nameIndex, sizeof(nameIndex));
+    so_success("IDX", "%s: %ld entradas", access(nameIndex, F_OK) == 0 ? nameIndex : nameDB, nEntries);
+    return 0;
+}
@@ -0,0 +1,155 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_reshard.c
+ ** Descrição/Explicação do Módulo:
+ **     Ferramenta que reparte a BD por N ficheiros (--split N), para o Servidor com
+ **     --shards N, ou que junta de novo esses N ficheiros numa só BD (--merge N).
+ **     Cada passageiro vai para o ficheiro bdShardOf(nif, N) (ver bd_shard.h), e os
+ **     registos mantêm a ordem relativa, pelo que cada ficheiro de uma BD ordenada
+ **     fica também ordenado. Os ficheiros ficam no layout da BD de origem, e o índice
+ **     é reconstruído em cada um se a origem tiver índice. Para passar de N para M
+ **     ficheiros, usar --merge N e depois --split M. Deve ser usada com o Servidor
+ **     parado; os ficheiros de origem não são apagados.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "bd.h"
+#include "bd_shard.h"
+#include <getopt.h>
+#include <sys/mman.h>
+
+static Bd *sources[BD_SHARDS_MAX];           // --split: só a BD de origem; --merge: os N ficheiros
+static int nSources;
+
+/**
+ * @brief O registo na posição position da sequência formada pelas BDs de origem, umas a seguir às outras
+ */
+static void getRecord (void *context, uint64_t position, CheckIn *record) {
+    int s = 0;
+    while (position >= sources[s]->count)
+        position -= sources[s++]->count;
+    bdGet(sources[s], position, record);
+}
+
+/**
+ * @brief Escreve em nameOutput o cabeçalho e os registos order[0..header->count) (ou todos, por ordem, se order for
+ *        NULL) no layout do cabeçalho (ver bdWriteFile()). Reconstrói o índice, se withIndex
+ */
+static void writeDB (const char *nameOutput, BdHeader *header, const uint64_t *order, int withIndex, int embedded) {
+    if (bdWriteFile(nameOutput, header, TRUE, order, getRecord, NULL) != 0)
+        exit(1);
+    long nEntries = withIndex ? bdIndexBuild(nameOutput, embedded) : 0;
+    if (nEntries < 0)
+        exit(1);
+    so_success("RESHARD", "%s: %llu registos%s", nameOutput, (unsigned long long) header->count,
+               withIndex ? ", índice reconstruído" : "");
+}
+
+/**
+ * @brief TRUE se a BD tiver índice, num ficheiro à parte ou embutido
+ */
+static int hasIndex (Bd *bd) {
+    char nameIndex[PATH_MAX];
+    bdIndexName(bd->name, nameIndex, sizeof(nameIndex));
+    return bd->header.indexOffset != 0 || access(nameIndex, F_OK) == 0;
+}
+
+/**
+ * @brief --split: reparte a BD nameDB pelos ficheiros nameOutput.shard0..n-1. As posições dos registos são agrupadas
+ *        por ficheiro (counting sort estável), e os registos da parte ordenada ficam à frente em cada um
+ */
+static void splitDB (const char *nameDB, const char *nameOutput, int n) {
+    Bd *bd = sources[nSources++] = bdMapOpen(nameDB, FALSE);
+    char nameShard[PATH_MAX];
+    size_t first[BD_SHARDS_MAX + 1] = { 0 }, sorted[BD_SHARDS_MAX] = { 0 };
+    if (!bd)
+        exit(1);
+    if (bd->map)
+        madvise(bd->map, bd->mapSize, MADV_SEQUENTIAL);
+
+    uint64_t *order = malloc(bd->count * sizeof(uint64_t) + 1);
+    if (!order) {
+        so_error("RESHARD", "Sem memória para %zu registos", bd->count);
+        exit(1);
+    }
+    uint64_t sortedCount = bd->header.flags & BD_FLAG_SORTED ? bd->header.sortedCount : 0;
+    for (size_t i = 0; i < bd->count; i++) {
+        int shard = bdShardOf(bdGetNif(bd, i), n);
+        first[shard + 1]++;
+        if (i < sortedCount)
+            sorted[shard]++;
+    }
+    for (int s = 0; s < n; s++)
+        first[s + 1] += first[s];
+    size_t next[BD_SHARDS_MAX];
+    memcpy(next, first, sizeof(next));
+    for (size_t i = 0; i < bd->count; i++)
+        order[next[bdShardOf(bdGetNif(bd, i), n)]++] = i;
+
+    for (int s = 0; s < n; s++) {
+        BdHeader header = bdHeaderInit(bd->layout, first[s + 1] - first[s], bd->header.flags & BD_FLAG_SORTED);
+        header.sortedCount = sorted[s];
+        bdShardName(nameOutput, s, nameShard, sizeof(nameShard));
+        writeDB(nameShard, &header, order + first[s], hasIndex(bd), bd->header.indexOffset != 0);
+    }
+    free(order);
+}
+
+/**
+ * @brief --merge: junta os ficheiros nameDB.shard0..n-1 na BD nameOutput, no layout do primeiro. O resultado não
+ *        está ordenado por NIF (ver bd_sort)
+ */
+static void mergeDB (const char *nameDB, const char *nameOutput, int n) {
+    char nameShard[PATH_MAX];
+    uint64_t count = 0;
+    int withIndex = FALSE;
+    for (int s = 0; s < n; s++) {
+        bdShardName(nameDB, s, nameShard, sizeof(nameShard));
+        if (!(sources[nSources++] = bdMapOpen(nameShard, FALSE)))
+            exit(1);
+        count += sources[s]->count;
+        withIndex = withIndex || hasIndex(sources[s]);
+    }
+    BdHeader header = bdHeaderInit(sources[0]->layout, count, 0);
+    writeDB(nameOutput, &header, NULL, withIndex, FALSE);
+}
+
+int main (int argc, char *argv[]) {
+    static struct option options[] = {
+        { "split", required_argument, NULL, 's' },
+        { "merge", required_argument, NULL, 'm' },
+        { NULL, 0, NULL, 0 }
+    };
+    int split = 0, merge = 0, option;
+
+    while ((option = getopt_long(argc, argv, "s:m:", options, NULL)) != -1) {
+        switch (option) {
+            case 's': split = atoi(optarg); break;
+            case 'm': merge = atoi(optarg); break;
+            default:
+            usage:
+                printf("Uso: %s (--split N | --merge N) [<binary-file.dat> [<output-file.dat>]]\n"
+                       "  -s, --split N           Reparte a BD pelos ficheiros <output-file.dat>.shard0..N-1 (--shards N)\n"
+                       "  -m, --merge N           Junta os ficheiros <binary-file.dat>.shard0..N-1 em <output-file.dat>\n"
+                       "N vai de 1 a %d; por omissão, <output-file.dat> é <binary-file.dat>. Os ficheiros de origem\n"
+                       "não são apagados\n",
+                       argv[0], BD_SHARDS_MAX);
+                exit(1);
+        }
+    }
+    char *nameDB = optind < argc ? argv[optind] : FILE_DATABASE;
+    char *nameOutput = optind + 1 < argc ? argv[optind + 1] : nameDB;
+    int n = split ? split : merge;
+    if (!split == !merge || n < 1 || n > BD_SHARDS_MAX || optind + 2 < argc)
+        goto usage;
+
+    if (split)
+        splitDB(nameDB, nameOutput, n);
+    else
+        mergeDB(nameDB, nameOutput, n);
+    for (int s = 0; s < nSources; s++)
+        bdClose(sources[s]);
+    return 0;
+}
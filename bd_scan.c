@@ -0,0 +1,167 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_scan.c
+ ** Descrição/Explicação do Módulo:
+ **     Implementação da pesquisa sequencial vetorizada (ver bd_scan.h). As versões
+ **     SIMD são compiladas com __attribute__((target(...))), pelo que o resto do
+ **     programa não precisa de -mavx2; cada bloco de NIFs é comparado por inteiro e
+ **     só quando há uma coincidência se procura a posição exata.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include "bd_scan.h"
+#include <immintrin.h>
+
+#define BD_SCAN_BLOCK 32             // NIFs comparados por iteração nas versões SIMD
+
+static long scanScalar (const int32_t *nifs, size_t count, size_t stride, int nif) {
+    for (size_t i = 0; i < count; i++)
+        if (nifs[i * stride] == nif)
+            return i;
+    return -1;
+}
+
+__attribute__((target("sse4.1")))
+static long scanSse41 (const int32_t *nifs, size_t count, int nif) {
+    const __m128i key = _mm_set1_epi32(nif);
+    size_t i = 0;
+    for (; i + BD_SCAN_BLOCK <= count; i += BD_SCAN_BLOCK) {
+        __m128i hits = _mm_setzero_si128();
+        for (int j = 0; j < BD_SCAN_BLOCK; j += 4)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (nifs + i + j)), key));
+        if (!_mm_testz_si128(hits, hits))
+            return i + scanScalar(nifs + i, BD_SCAN_BLOCK, 1, nif);
+    }
+    long tail = scanScalar(nifs + i, count - i, 1, nif);
+    return tail < 0 ? -1 : (long) i + tail;
+}
+
+__attribute__((target("avx2")))
+static long scanAvx2 (const int32_t *nifs, size_t count, int nif) {
+    const __m256i key = _mm256_set1_epi32(nif);
+    size_t i = 0;
+    for (; i + BD_SCAN_BLOCK <= count; i += BD_SCAN_BLOCK) {
+        __m256i hits = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (nifs + i)), key),
+                            _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (nifs + i + 8)), key)),
+            _mm256_or_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (nifs + i + 16)), key),
+                            _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (nifs + i + 24)), key)));
+        if (!_mm256_testz_si256(hits, hits))
+            return i + scanScalar(nifs + i, BD_SCAN_BLOCK, 1, nif);
+    }
+    long tail = scanScalar(nifs + i, count - i, 1, nif);
+    return tail < 0 ? -1 : (long) i + tail;
+}
+
+/**
+ * @brief Versão AVX2 com stride: cada gather lê o nif de 8 registos consecutivos
+ */
+__attribute__((target("avx2")))
+static long scanAvx2Strided (const int32_t *nifs, size_t count, size_t stride, int nif) {
+    const __m256i key = _mm256_set1_epi32(nif);
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    size_t i = 0;
+    if (stride * 8 <= INT32_MAX / 8) {               // Os offsets do gather são int32
+        for (; i + BD_SCAN_BLOCK <= count; i += BD_SCAN_BLOCK) {
+            const int32_t *base = nifs + i * stride;
+            __m256i hits = _mm256_setzero_si256();
+            for (int j = 0; j < BD_SCAN_BLOCK; j += 8)
+                hits = _mm256_or_si256(hits, _mm256_cmpeq_epi32(_mm256_i32gather_epi32((const int *) (base + j * stride), offsets, 4), key));
+            if (!_mm256_testz_si256(hits, hits))
+                return i + scanScalar(base, BD_SCAN_BLOCK, stride, nif);
+        }
+    }
+    long tail = scanScalar(nifs + i * stride, count - i, stride, nif);
+    return tail < 0 ? -1 : (long) i + tail;
+}
+
+/**
+ * @brief A versão mais rápida suportada pelo CPU (determinada uma única vez)
+ */
+BdScanKernel bdScanKernelBest () {
+    static BdScanKernel best = BD_SCAN_AUTO;
+    if (best == BD_SCAN_AUTO) {
+        __builtin_cpu_init();
+        best = __builtin_cpu_supports("avx2") ? BD_SCAN_AVX2 : __builtin_cpu_supports("sse4.1") ? BD_SCAN_SSE41 : BD_SCAN_SCALAR;
+    }
+    return best;
+}
+
+int bdScanKernelSupported (BdScanKernel kernel) {
+    return kernel == BD_SCAN_AUTO || kernel <= bdScanKernelBest();
+}
+
+const char *bdScanKernelName (BdScanKernel kernel) {
+    switch (kernel == BD_SCAN_AUTO ? bdScanKernelBest() : kernel) {
+        case BD_SCAN_AVX2:  return "avx2";
+        case BD_SCAN_SSE41: return "sse4.1";
+        default:            return "scalar";
+    }
+}
+
+/**
+ * @brief Pesquisa sequencial do NIF nif
+ * @param nifs   O nif do primeiro registo
+ * @param count  O nº de registos
+ * @param stride A distância (em int32_t) entre os nif de dois registos consecutivos
+ * @param kernel A versão a usar (BD_SCAN_AUTO: a mais rápida; uma versão não suportada usa a escalar)
+ * @return long  O índice do primeiro registo com o NIF dado, ou -1 se não existir
+ */
+long bdScanNifKernel (const int32_t *nifs, size_t count, size_t stride, int nif, BdScanKernel kernel) {
+    if (kernel == BD_SCAN_AUTO)
+        kernel = bdScanKernelBest();
+    else if (!bdScanKernelSupported(kernel))
+        kernel = BD_SCAN_SCALAR;
+    if (kernel == BD_SCAN_AVX2)
+        return stride == 1 ? scanAvx2(nifs, count, nif) : scanAvx2Strided(nifs, count, stride, nif);
+    if (kernel == BD_SCAN_SSE41 && stride == 1)
+        return scanSse41(nifs, count, nif);
+    return scanScalar(nifs, count, stride, nif);
+}
+
+/**
+ * @brief Pesquisa por interpolação de um NIF em count NIFs estritamente crescentes. Cada passo estima a
+ *        posição pela reta entre os extremos do intervalo; se um passo não reduzir o intervalo para metade,
+ *        o seguinte é uma bisseção, pelo que mesmo uma distribuição irregular custa O(log n) leituras
+ * @param nifAt   Lê o NIF na posição i (-1 em caso de erro)
+ * @return long   A posição do NIF, ou -1 se não existir (ou em caso de erro)
+ */
+long bdInterpolationSearch (uint64_t count, int nif, BdNifReader nifAt, void *context) {
+    if (count == 0)
+        return -1;
+    uint64_t low = 0, high = count - 1;
+    int32_t lowNif = nifAt(context, low), highNif = nifAt(context, high);
+    int bisect = FALSE;
+    while (lowNif >= 0 && highNif >= 0 && nif >= lowNif && nif <= highNif) {
+        if (nif == lowNif)
+            return low;
+        if (nif == highNif)
+            return high;
+        if (high - low <= 1)
+            return -1;
+        uint64_t middle = bisect ? low + (high - low) / 2
+                                 : low + (uint64_t) ((double) (nif - lowNif) / ((double) highNif - lowNif) * (high - low));
+        if (middle <= low)
+            middle = low + 1;
+        else if (middle >= high)
+            middle = high - 1;
+        int32_t middleNif = nifAt(context, middle);
+        uint64_t previous = high - low;
+        if (middleNif < 0)
+            return -1;
+        if (middleNif == nif)
+            return middle;
+        if (middleNif < nif) {
+            low = middle;
+            lowNif = middleNif;
+        } else {
+            high = middle;
+            highNif = middleNif;
+        }
+        bisect = !bisect && high - low > previous / 2;
+    }
+    return -1;
+}
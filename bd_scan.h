@@ -0,0 +1,43 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_scan.h
+ ** Descrição/Explicação do Módulo:
+ **     Pesquisa sequencial de um NIF, usada em SD10 quando não há índice. Compara
+ **     vários NIFs por instrução (SSE4.1: 4, AVX2: 8), quer sobre a coluna nif de
+ **     uma BD colunar, quer sobre os registos CheckIn (gather com stride). A versão
+ **     é escolhida em tempo de execução, conforme o CPU, com uma versão escalar
+ **     para os restantes casos. Numa BD ordenada (BD_FLAG_SORTED), a pesquisa é
+ **     por interpolação, já que os NIFs estão distribuídos de forma quase uniforme.
+ **
+ ******************************************************************************/
+#ifndef __BD_SCAN_H__
+#define __BD_SCAN_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    BD_SCAN_AUTO = 0,           // A melhor versão suportada pelo CPU
+    BD_SCAN_SCALAR,             // Um NIF de cada vez
+    BD_SCAN_SSE41,              // 4 NIFs por comparação (só na coluna nif; com stride usa a versão escalar)
+    BD_SCAN_AVX2                // 8 NIFs por comparação (com stride, usa _mm256_i32gather_epi32)
+} BdScanKernel;
+
+/**
+ * O NIF do registo i está em nifs[i * stride]: stride = 1 na coluna nif, sizeof(CheckIn) / sizeof(int32_t)
+ * nos registos CheckIn (o nif é o primeiro campo)
+ */
+long bdScanNifKernel (const int32_t *nifs, size_t count, size_t stride, int nif, BdScanKernel kernel);
+BdScanKernel bdScanKernelBest (void);               // A versão usada por BD_SCAN_AUTO
+int  bdScanKernelSupported (BdScanKernel kernel);   // TRUE se o CPU suportar a versão dada
+const char *bdScanKernelName (BdScanKernel kernel); // "scalar", "sse4.1" ou "avx2"
+
+/**
+ * Pesquisa por interpolação num vetor ordenado de count NIFs, lidos com nifAt(context, i) (e.g., da memória
+ * ou com pread()). nifAt devolve -1 em caso de erro, que termina a pesquisa
+ */
+typedef int32_t (*BdNifReader) (void *context, uint64_t i);
+long bdInterpolationSearch (uint64_t count, int nif, BdNifReader nifAt, void *context);
+
+#endif  // __BD_SCAN_H__
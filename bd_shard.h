@@ -0,0 +1,38 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_shard.h
+ ** Descrição/Explicação do Módulo:
+ **     BD repartida por N ficheiros (--shards N): o passageiro com um dado NIF está
+ **     sempre no ficheiro bdShardOf(nif, N), e cada ficheiro é uma BD completa, com o
+ **     seu cabeçalho e o seu índice (e.g., bd_passageiros.dat.shard0.idx). Os pedidos
+ **     só trazem o NIF, pelo que é ele que escolhe o ficheiro. Os ficheiros são
+ **     criados e juntados de novo com bd_reshard.
+ **
+ ******************************************************************************/
+#ifndef __BD_SHARD_H__
+#define __BD_SHARD_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define FILE_SUFFIX_SHARD  ".shard"      // Sufixo de cada ficheiro, seguido do nº (e.g., bd_passageiros.dat.shard3)
+#define BD_SHARDS_MAX      32            // Nº máximo de ficheiros (cada um ocupa uma das BD_MAX_OPEN BDs abertas)
+
+/**
+ * @brief O ficheiro (0..nShards-1) do passageiro com o NIF dado. O hash multiplicativo espalha NIFs
+ *        consecutivos, e a multiplicação de 64 bits evita o viés do resto da divisão
+ */
+static inline int bdShardOf (int nif, int nShards) {
+    uint32_t hash = (uint32_t) nif * 2654435761u;
+    return (int) (((uint64_t) hash * (uint32_t) nShards) >> 32);
+}
+
+/**
+ * @brief Constrói o nome do ficheiro shard da BD nameDB (i.e., nameDB + FILE_SUFFIX_SHARD + shard)
+ */
+static inline void bdShardName (const char *nameDB, int shard, char *buffer, size_t size) {
+    snprintf(buffer, size, "%s%s%d", nameDB, FILE_SUFFIX_SHARD, shard);
+}
+
+#endif  // __BD_SHARD_H__
@@ -0,0 +1,164 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: bd_sort.c
+ ** Descrição/Explicação do Módulo:
+ **     Ferramenta que ordena a BD por NIF e a compacta (remove os registos sem NIF
+ **     e os NIFs repetidos, ficando o primeiro, tal como na pesquisa sequencial),
+ **     marcando-a como ordenada (BD_FLAG_SORTED) para que SD10 possa usar a
+ **     pesquisa por interpolação. Novos passageiros podem ser acrescentados no fim
+ **     (--append), sem ordenar; com --merge, só esses registos são ordenados e
+ **     depois intercalados com os já ordenados, sem ordenar de novo toda a BD.
+ **     A BD é escrita num ficheiro temporário e depois renomeada, e o índice, se
+ **     existir, é reconstruído. Deve ser usada com o Servidor parado.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "bd.h"
+#include <getopt.h>
+
+#define SORT_RADIX_BITS  11                  // Radix sort em 3 passagens de 11 bits (NIFs < 2^33)
+
+static Bd *bdMain, *bdNew;                   // A BD a ordenar e (com --append) a BD com os novos passageiros
+
+/**
+ * @brief O registo na posição position: da BD original ou, a seguir a esta, da BD acrescentada com --append
+ */
+static void getRecord (void *context, uint64_t position, CheckIn *record) {
+    if (position < bdMain->count)
+        bdGet(bdMain, position, record);
+    else
+        bdGet(bdNew, position - bdMain->count, record);
+}
+
+/**
+ * @brief Chave de ordenação: o NIF nos 32 bits mais significativos e a posição original nos restantes,
+ *        para que, entre NIFs repetidos, o primeiro registo fique à frente
+ */
+static uint64_t sortKey (int nif, uint64_t position) {
+    return (uint64_t) nif << 32 | position;
+}
+
+/**
+ * @brief Ordena as chaves pelo NIF (radix sort estável, LSD), mantendo a ordem das posições para o mesmo NIF
+ */
+static void radixSort (uint64_t *keys, size_t count) {
+    uint64_t *scratch = malloc(count * sizeof(uint64_t));
+    size_t histogram[1 << SORT_RADIX_BITS];
+    if (!scratch) {
+        so_error("SORT", "Sem memória para ordenar %zu registos", count);
+        exit(1);
+    }
+    for (int shift = 32; shift < 64; shift += SORT_RADIX_BITS) {
+        memset(histogram, 0, sizeof(histogram));
+        for (size_t i = 0; i < count; i++)
+            histogram[(keys[i] >> shift) & ((1 << SORT_RADIX_BITS) - 1)]++;
+        for (size_t digit = 0, total = 0; digit < (1 << SORT_RADIX_BITS); digit++) {
+            size_t n = histogram[digit];
+            histogram[digit] = total;
+            total += n;
+        }
+        for (size_t i = 0; i < count; i++)
+            scratch[histogram[(keys[i] >> shift) & ((1 << SORT_RADIX_BITS) - 1)]++] = keys[i];
+        memcpy(keys, scratch, count * sizeof(uint64_t));
+    }
+    free(scratch);
+}
+
+/**
+ * @brief Intercala as chaves já ordenadas sorted[0..nSorted) com as novas tail[0..nTail), também ordenadas,
+ *        deixando em order as posições dos registos a escrever (sem NIFs repetidos: fica o primeiro)
+ * @return size_t O nº de registos a escrever
+ */
+static size_t mergeKeys (const uint64_t *sorted, size_t nSorted, const uint64_t *tail, size_t nTail, uint64_t *order) {
+    size_t i = 0, j = 0, n = 0;
+    int64_t lastNif = -1;
+    while (i < nSorted || j < nTail) {
+        uint64_t key = j == nTail || (i < nSorted && sorted[i] <= tail[j]) ? sorted[i++] : tail[j++];
+        if ((int64_t) (key >> 32) != lastNif)
+            order[n++] = key & 0xFFFFFFFF;
+        lastNif = key >> 32;
+    }
+    return n;
+}
+
+int main (int argc, char *argv[]) {
+    static struct option options[] = {
+        { "append", required_argument, NULL, 'a' },
+        { "merge", no_argument, NULL, 'm' },
+        { NULL, 0, NULL, 0 }
+    };
+    char *nameAppend = NULL, nameIndex[PATH_MAX];
+    int merge = FALSE, option;
+
+    while ((option = getopt_long(argc, argv, "a:m", options, NULL)) != -1) {
+        switch (option) {
+            case 'a': nameAppend = optarg; break;
+            case 'm': merge = TRUE; break;
+            default:
+                printf("Uso: %s [opções] [<binary-file.dat> [<output-file.dat>]]\n"
+                       "  (sem opções)            Ordena toda a BD por NIF e compacta-a\n"
+                       "  -a, --append BD         Acrescenta os passageiros de BD no fim, sem ordenar\n"
+                       "  -m, --merge             Ordena só os registos acrescentados e intercala-os com os ordenados\n"
+                       "A BD é alterada no próprio ficheiro se não for dado <output-file.dat>\n",
+                       argv[0]);
+                exit(1);
+        }
+    }
+    char *nameDB = optind < argc ? argv[optind] : FILE_DATABASE;
+    char *nameOutput = optind + 1 < argc ? argv[optind + 1] : nameDB;
+    if (nameAppend && merge) {
+        so_error("SORT", "--append e --merge não podem ser usadas em simultâneo");
+        exit(1);
+    }
+
+    if (!(bdMain = bdMapOpen(nameDB, FALSE)) || (nameAppend && !(bdNew = bdMapOpen(nameAppend, FALSE))))
+        exit(1);
+    BdHeader header = bdHeaderInit(bdMain->layout, bdMain->count, bdMain->header.flags);
+    int embedded = bdMain->header.indexOffset != 0;
+    uint64_t *order = NULL;
+    size_t count = bdMain->count;
+
+    if (nameAppend) {                // Os novos registos ficam a seguir, fora da parte ordenada
+        count += bdNew->count;
+        header.count = count;
+        header.sortedCount = bdMain->header.sortedCount;
+    } else {
+        // Com --merge, os primeiros sortedCount registos já estão ordenados e sem NIFs repetidos
+        size_t nSorted = merge && (bdMain->header.flags & BD_FLAG_SORTED) ? bdMain->header.sortedCount : 0, nTail = 0;
+        uint64_t *keys = malloc(count * sizeof(uint64_t));
+        if (!(order = malloc(count * sizeof(uint64_t))) || !keys) {
+            so_error("SORT", "Sem memória para %zu registos", count);
+            exit(1);
+        }
+        for (size_t i = 0; i < nSorted; i++)
+            keys[i] = sortKey(bdGetNif(bdMain, i), i);
+        for (size_t i = nSorted; i < count; i++) {
+            int nif = bdGetNif(bdMain, i);
+            if (nif > 0)
+                keys[nSorted + nTail++] = sortKey(nif, i);
+        }
+        radixSort(keys + nSorted, nTail);
+        count = mergeKeys(keys, nSorted, keys + nSorted, nTail, order);
+        free(keys);
+        header.count = header.sortedCount = count;
+        header.flags |= BD_FLAG_SORTED;
+    }
+
+    if (bdWriteFile(nameOutput, &header, TRUE, order, getRecord, NULL) != 0)
+        exit(1);
+    so_success("SORT", "%s: %zu registos, %llu ordenados (%zu removidos)", nameOutput, count,
+               (unsigned long long) header.sortedCount, bdMain->count + (bdNew ? bdNew->count : 0) - count);
+
+    // Os registos mudaram de posição: o índice, se existir, tem de ser reconstruído
+    bdIndexName(nameOutput, nameIndex, sizeof(nameIndex));
+    if ((embedded && !strcmp(nameOutput, nameDB)) || access(nameIndex, F_OK) == 0) {
+        long nEntries = bdIndexBuild(nameOutput, embedded && !strcmp(nameOutput, nameDB));
+        if (nEntries < 0)
+            exit(1);
+        so_success("SORT", "Índice reconstruído: %ld entradas", nEntries);
+    }
+    free(order);
+    return 0;
+}
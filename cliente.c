@@ -8,6 +8,17 @@
 
 #define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
 #include "common.h"
+#include "protocol.h"
+#include "request_ring.h"
+#include <getopt.h>
+
+int textProtocol;    // --text-protocol: envia o pedido no formato de texto original, em vez de RequestFrame
+int useRing;         // --ring: envia o pedido pelo anel do Servidor (ver request_ring.h), se o Servidor o tiver criado
+char replyFifo[32];  // Nome do FIFO de resposta deste Cliente ("<pid>.fifo")
+int replyFd = -1;    // FIFO de resposta, aberto para leitura (-1 se não foi possível criá-lo: espera por sinais)
+
+void createReplyFifo ();
+void removeReplyFifo ();
 
 /**
  * @brief Processamento do processo Cliente
@@ -15,13 +26,31 @@
  *         Deverão, sim, completar as funções seguintes à main(), nos locais onde está claramente assinalado
  *         '// Substituir este comentário pelo código da função a ser implementado pelo aluno' "
  */
-int main () {
+int main (int argc, char *argv[]) {
+    static struct option options[] = {
+        { "text-protocol", no_argument, NULL, 't' },
+        { "ring", no_argument, NULL, 'R' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "tR", options, NULL)) != -1) {
+        if ((option != 't' && option != 'R') || (option == 'R' ? textProtocol : useRing)) {
+            printf("Uso: %s [-t|--text-protocol | -R|--ring]\n", argv[0]);
+            exit(1);
+        }
+        if (option == 't')
+            textProtocol = TRUE;
+        else
+            useRing = TRUE;
+    }
     // C1
     checkExistsFifoServidor_C1(FILE_REQUESTS);
     // C2
     triggerSignals_C2();
     // C3 + C4
     CheckIn clientRequest = getDadosPedidoUtilizador_C3_C4();
+    // FIFO de resposta, criado antes do pedido para que o Servidor Dedicado o encontre
+    createReplyFifo();
     // C5
     writeRequest_C5(clientRequest, FILE_REQUESTS);
     // C6
@@ -44,22 +73,7 @@ int main () {
  */
 void checkExistsFifoServidor_C1 (char *nameFifo) {
     so_debug("< [@param nameFifo:%s]", nameFifo);
-    struct stat statbuf;
-    if (access(nameFifo, F_OK) != -1) {
-        if (stat(nameFifo, &statbuf) == -1) {
-            so_error("C1", "Erro ao obter informações sobre o arquivo '%s'", nameFifo);
-            exit(1);
-        }
-        if ((statbuf.st_mode & S_IFMT) == S_IFIFO) {
-            so_success("C1", "O ficheiro existe e é um FIFO.");
-        } else {
-            so_error("C1", "O arquivo '%s' não é um FIFO.", nameFifo);
-            exit(1);
-        }
-    } else {
-        so_error("C1", "O ficheiro '%s' não existe!", nameFifo);
-        exit(1);
-    }
+    requestFifoCheck(nameFifo);
     so_debug(">");
 }
 
@@ -116,6 +130,42 @@ CheckIn getDadosPedidoUtilizador_C3_C4 () {
     return request;
 }
 
+/**
+ * @brief Cria o FIFO de resposta "<pid>.fifo", onde o Servidor Dedicado escreve o resultado do check-in.
+ *        Se não for possível criá-lo, o Cliente continua a funcionar só com os sinais SIGUSR1/SIGHUP
+ */
+void createReplyFifo () {
+    so_debug("<");
+    replyFifoName(getpid(), replyFifo, sizeof(replyFifo));
+    unlink(replyFifo);
+    if (mkfifo(replyFifo, 0666) == -1) {
+        so_debug("> Sem FIFO de resposta: %s", strerror(errno));
+        return;
+    }
+    atexit(removeReplyFifo);     // C8..C11 terminam com exit()
+
+    // O leitor é aberto com O_NONBLOCK (ainda não há escritor), e o escritor auxiliar garante que
+    // read() bloqueia até chegar a resposta em vez de devolver EOF
+    replyFd = open(replyFifo, O_RDONLY | O_NONBLOCK);
+    if (replyFd == -1 || open(replyFifo, O_WRONLY) == -1 ||
+            fcntl(replyFd, F_SETFL, fcntl(replyFd, F_GETFL) & ~O_NONBLOCK) == -1) {
+        removeReplyFifo();
+        so_debug("> Sem FIFO de resposta");
+        return;
+    }
+    so_debug("> [replyFifo:%s]", replyFifo);
+}
+
+/**
+ * @brief Apaga o FIFO de resposta do Cliente (chamada no fim do processo)
+ */
+void removeReplyFifo () {
+    if (replyFd != -1)
+        close(replyFd);
+    replyFd = -1;
+    unlink(replyFifo);
+}
+
 /**
  * @brief C5       Ler a descrição da tarefa C5 no enunciado
  * @param request  Elemento com os dados a enviar
@@ -123,7 +173,6 @@ CheckIn getDadosPedidoUtilizador_C3_C4 () {
  */
 void writeRequest_C5 (CheckIn request, char *nameFifo) {
     int fd;
-    char buffer[sizeof(CheckIn)]; 
     so_debug("< [@param request.nif:%d, request.senha:%s, request.pidCliente:%d, nameFifo:%s]",
                                         request.nif, request.senha, request.pidCliente, nameFifo);
     fd = open(nameFifo, O_WRONLY);
@@ -135,9 +184,18 @@ void writeRequest_C5 (CheckIn request, char *nameFifo) {
         so_success("C5", "SUCESSO EM ABRIR O FIFO %s", nameFifo);
     }
 
-    snprintf(buffer, sizeof(buffer), "%d\n%s\n%d\n", request.nif, request.senha, request.pidCliente);
-
-    if (write(fd, buffer, strlen(buffer)) == -1) {
+    // --ring: o FIFO, já aberto, identifica o anel do Servidor; sem anel, ou com o anel cheio, o pedido vai pelo FIFO
+    RequestRing *ring = useRing ? requestRingOpen(fd) : NULL;
+    if (ring && requestRingWrite(ring, fd, request) == 0) {
+        so_success("C5", "SUCESSO NA ESCRITA DO ANEL DE %s", nameFifo);
+        munmap(ring, sizeof(RequestRing));
+        close(fd);
+        so_debug(">");
+        return;
+    }
+    if (ring)
+        munmap(ring, sizeof(RequestRing));
+    if (requestWrite(fd, request, textProtocol) == -1) { // Uma única escrita atómica (< PIPE_BUF)
         so_error("C5", "ERRO NA ESCRITA DO FIFO %s", nameFifo);
         exit(1);
     } else {
@@ -163,7 +221,26 @@ void configureTimer_C6 (int tempoEspera) {
  * @brief C7 Ler a descrição da tarefa C7 no enunciado
  */
 void waitForEvents_C7 () {
+    ReplyFrame reply;
+    ssize_t bytesRead;
     so_debug("<");
+
+    // Com FIFO de resposta, o resultado vem numa única trama; o SIGALRM (C11) continua a limitar a espera
+    while (replyFd != -1) {
+        while ((bytesRead = read(replyFd, &reply, sizeof(reply))) == -1 && errno == EINTR);
+        if (bytesRead == sizeof(reply) && replyFrameCheck(&reply) == 0 && reply.nif > 0) {
+            if (reply.status == REPLY_OK) {
+                so_success("C8", "Check-in concluído com sucesso: %s, voo %s (SD %d: pesquisa %u µs, check-in %u µs, espera %u µs, total %u µs)",
+                           reply.nome, reply.nrVoo, reply.pidServidorDedicado,
+                           reply.lookupMicros, reply.checkinMicros, reply.delayMicros, reply.totalMicros);
+                exit(0);
+            }
+            so_success("C9", "Check-in concluído sem sucesso: %s", replyStatusText(reply.status));
+            exit(1);
+        }
+        if (bytesRead <= 0)
+            break;               // Resposta inválida ou erro: resta esperar pelos sinais
+    }
     pause();
     so_debug(">");
 }
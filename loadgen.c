@@ -0,0 +1,397 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: loadgen.c
+ ** Descrição/Explicação do Módulo:
+ **     Gerador de carga para o Servidor. Simula muitos Clientes em simultâneo a
+ **     partir de um único processo: a thread principal escreve os pedidos no FIFO
+ **     do servidor (C5) ao ritmo pedido, com um limite de pedidos em curso, e uma
+ **     segunda thread lê as respostas do FIFO de resposta do processo, associando
+ **     cada ReplyFrame ao pedido pelo NIF (C8/C9). Os pedidos sem resposta ao fim
+ **     de --timeout segundos contam como timeout (C11), e o seu par só volta a ser
+ **     usado quando chegar a resposta atrasada, que nunca é atribuída a outro
+ **     pedido. Com --ring, os pedidos vão pelo anel em memória partilhada do
+ **     Servidor (ver request_ring.h), e só pelo FIFO quando o anel está cheio. No
+ **     fim, mostra o débito (respostas por segundo) e as latências p50/p99/p999.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include "protocol.h"
+#include "request_ring.h"
+#include "bd.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define LOADGEN_SWEEP_MS 100         // Intervalo entre verificações de pedidos sem resposta
+
+typedef struct Pair {
+    int    nif;
+    char   senha[40];
+    double start;                    // Instante do envio (s), ou 0 se o par não tiver um pedido em curso
+    int    expired;                  // O pedido deu timeout e a resposta ainda não chegou: o par não é usado
+    struct Pair *older, *newer;      // Vizinhos na lista dos pedidos em curso, ordenada por start
+} Pair;
+
+typedef struct {
+    long   total;                    // -n: nº de pedidos a enviar
+    int    concurrency;              // -c: nº máximo de pedidos em curso
+    double rate;                     // -r: pedidos por segundo (0 = sem limite)
+    double timeout;                  // -T: tempo máximo de espera por uma resposta (s)
+    int    textProtocol;             // -t: envia os pedidos no formato de texto original
+    int    ring;                     // -R: envia os pedidos pelo anel do Servidor (--ring)
+    char  *pairsFile;                // -f: ficheiro com pares "nif senha" (e.g., bd_generate --pairs)
+    char  *nameDB;                   // -b: BD de onde são lidos os pares, se não houver -f
+} LoadgenConfig;
+
+static LoadgenConfig config = { 1000, 64, 0, MAX_ESPERA, FALSE, FALSE, NULL, FILE_DATABASE };
+static Pair *pairs;                  // Pares ordenados por NIF, para encontrar o pedido de cada resposta
+static size_t nPairs;
+static double *latencies;            // Latência de cada pedido respondido (s)
+static long nLatencies, nOk, nFailed, nTimeouts, nLate, inFlight;
+static long nExpired;                // Pares fora de rotação, à espera da resposta a um pedido que deu timeout
+static Pair *oldest, *newest;        // Lista dos pedidos em curso, do envio mais antigo para o mais recente
+static double nextSweep;             // Instante da próxima verificação dos pedidos sem resposta
+static long failedBy[REPLY_ERROR + 1];
+static atomic_long signalsOk, signalsFailed;   // Respostas por sinal (o Servidor não conseguiu usar o FIFO)
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replied = PTHREAD_COND_INITIALIZER;
+static char replyFifo[32];
+
+/**
+ * @brief Relógio monotónico, em segundos
+ */
+static double now () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int comparePairs (const void *a, const void *b) {
+    const Pair *pa = a, *pb = b;
+    return (pa->nif > pb->nif) - (pa->nif < pb->nif);
+}
+
+static int compareDoubles (const void *a, const void *b) {
+    double da = *(const double *) a, db = *(const double *) b;
+    return (da > db) - (da < db);
+}
+
+/**
+ * @brief Lê os pares (nif, senha) de config.pairsFile ou, se não for dado, dos registos de config.nameDB.
+ *        Os pares ficam ordenados por NIF e sem NIFs repetidos
+ */
+static void loadPairs () {
+    size_t capacity = 1024, next = 0;
+    FILE *file = config.pairsFile ? fopen(config.pairsFile, "r") : NULL;
+    Bd *bd = config.pairsFile ? NULL : bdMapOpen(config.nameDB, FALSE);  // Qualquer layout (ver bd_format.h)
+    if ((!file && !bd) || !(pairs = malloc(capacity * sizeof(Pair)))) {
+        so_error("LOADGEN", "Erro ao abrir %s", config.pairsFile ? config.pairsFile : config.nameDB);
+        exit(1);
+    }
+
+    CheckIn record;
+    while (TRUE) {
+        if (nPairs == capacity && !(pairs = realloc(pairs, (capacity *= 2) * sizeof(Pair)))) {
+            so_error("LOADGEN", "Sem memória para os pares");
+            exit(1);
+        }
+        Pair *pair = &pairs[nPairs];
+        if (config.pairsFile) {
+            if (fscanf(file, "%d %39s", &pair->nif, pair->senha) != 2)
+                break;
+        } else {
+            if (next == bd->count)
+                break;
+            bdGet(bd, next++, &record);
+            pair->nif = record.nif;
+            snprintf(pair->senha, sizeof(pair->senha), "%s", record.senha);
+        }
+        pair->start = 0;
+        pair->expired = FALSE;
+        if (pair->nif > 0)
+            nPairs++;
+    }
+    if (file)
+        fclose(file);
+    else
+        bdClose(bd);
+
+    qsort(pairs, nPairs, sizeof(Pair), comparePairs);
+    size_t unique = 0;
+    for (size_t i = 0; i < nPairs; i++)
+        if (unique == 0 || pairs[i].nif != pairs[unique - 1].nif)
+            pairs[unique++] = pairs[i];
+    nPairs = unique;
+    if (nPairs == 0) {
+        so_error("LOADGEN", "Não há pares (nif, senha) para enviar");
+        exit(1);
+    }
+}
+
+/**
+ * @brief O par com o NIF dado (pesquisa binária), ou NULL
+ */
+static Pair *findPair (int nif) {
+    Pair key = { .nif = nif };
+    return bsearch(&key, pairs, nPairs, sizeof(Pair), comparePairs);
+}
+
+/**
+ * @brief C5: o pedido do par acabou de ser enviado (com lock). Os envios são feitos por ordem, pelo que o par fica
+ *        no fim da lista dos pedidos em curso
+ */
+static void startRequest (Pair *pair) {
+    pair->start = now();
+    pair->older = newest;
+    pair->newer = NULL;
+    *(newest ? &newest->newer : &oldest) = pair;
+    newest = pair;
+    inFlight++;
+}
+
+/**
+ * @brief O pedido do par já não está em curso (com lock): chegou a resposta, ou deu timeout
+ */
+static void endRequest (Pair *pair) {
+    *(pair->older ? &pair->older->newer : &oldest) = pair->newer;
+    *(pair->newer ? &pair->newer->older : &newest) = pair->older;
+    pair->start = 0;
+    inFlight--;
+}
+
+/**
+ * @brief C11: conta como timeout os pedidos em curso há mais de config.timeout segundos (com lock). Só vê o início
+ *        da lista dos pedidos em curso, onde estão os mais antigos. O par fica fora de rotação até chegar a resposta
+ *        atrasada, que só traz o NIF: doutra forma, seria atribuída ao pedido seguinte do mesmo par
+ */
+static void expireRequests () {
+    double limit = now() - config.timeout;
+    nextSweep = limit + config.timeout + LOADGEN_SWEEP_MS / 1000.0;
+    while (oldest && oldest->start < limit) {
+        Pair *pair = oldest;
+        endRequest(pair);
+        pair->expired = TRUE;
+        nExpired++;
+        nTimeouts++;
+    }
+}
+
+/**
+ * @brief Thread que lê as respostas do FIFO de resposta (C7) e as associa aos pedidos em curso (C8/C9)
+ */
+static void *receiveReplies (void *fifo) {
+    int fd = *(int *) fifo;
+    ReplyFrame reply;
+    ssize_t bytesRead;
+
+    while ((bytesRead = read(fd, &reply, sizeof(reply))) == sizeof(reply) || (bytesRead == -1 && errno == EINTR)) {
+        if (bytesRead != sizeof(reply) || replyFrameCheck(&reply) != 0)
+            continue;
+        double end = now();
+        pthread_mutex_lock(&lock);
+        Pair *pair = findPair(reply.nif);
+        if (pair && pair->expired) {     // Resposta ao pedido que deu timeout: o par volta a estar disponível
+            pair->expired = FALSE;
+            nExpired--;
+            nLate++;
+            pthread_cond_signal(&replied);
+        } else if (pair && pair->start > 0 && end - pair->start > config.timeout) {
+            nTimeouts++;                 // Ainda não tinha sido verificado por expireRequests()
+            nLate++;
+            endRequest(pair);
+            pthread_cond_signal(&replied);
+        } else if (pair && pair->start > 0) {
+            latencies[nLatencies++] = end - pair->start;
+            if (reply.status == REPLY_OK)
+                nOk++;
+            else {
+                nFailed++;
+                failedBy[reply.status <= REPLY_ERROR ? reply.status : REPLY_ERROR]++;
+            }
+            endRequest(pair);
+            pthread_cond_signal(&replied);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static void trataSinalResposta (int sinalRecebido) {
+    atomic_fetch_add(sinalRecebido == SIGUSR1 ? &signalsOk : &signalsFailed, 1);
+}
+
+/**
+ * @brief Cria o FIFO de resposta "<pid>.fifo", comum a todos os pedidos deste processo
+ * @return int O descritor de leitura
+ */
+static int createReplyFifo () {
+    replyFifoName(getpid(), replyFifo, sizeof(replyFifo));
+    unlink(replyFifo);
+    int fd = -1;
+    if (mkfifo(replyFifo, 0666) == -1 || (fd = open(replyFifo, O_RDONLY | O_NONBLOCK)) == -1 ||
+            open(replyFifo, O_WRONLY) == -1 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) == -1) {
+        so_error("LOADGEN", "Erro ao criar o FIFO de resposta %s", replyFifo);
+        unlink(replyFifo);
+        exit(1);
+    }
+    return fd;
+}
+
+static void parseArguments (int argc, char *argv[]) {
+    static struct option options[] = {
+        { "requests", required_argument, NULL, 'n' },
+        { "concurrency", required_argument, NULL, 'c' },
+        { "rate", required_argument, NULL, 'r' },
+        { "timeout", required_argument, NULL, 'T' },
+        { "pairs", required_argument, NULL, 'f' },
+        { "database", required_argument, NULL, 'b' },
+        { "text-protocol", no_argument, NULL, 't' },
+        { "ring", no_argument, NULL, 'R' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option;
+
+    while ((option = getopt_long(argc, argv, "n:c:r:T:f:b:tR", options, NULL)) != -1) {
+        switch (option) {
+            case 'n': config.total = atol(optarg); break;
+            case 'c': config.concurrency = atoi(optarg); break;
+            case 'r': config.rate = atof(optarg); break;
+            case 'T': config.timeout = atof(optarg); break;
+            case 'f': config.pairsFile = optarg; break;
+            case 'b': config.nameDB = optarg; break;
+            case 't': config.textProtocol = TRUE; break;
+            case 'R': config.ring = TRUE; break;
+            default:
+                printf("Uso: %s [opções]\n"
+                       "  -n, --requests N        Nº de pedidos a enviar (por omissão %ld)\n"
+                       "  -c, --concurrency C     Nº máximo de pedidos em curso (por omissão %d)\n"
+                       "  -r, --rate R            Pedidos por segundo (0 = sem limite)\n"
+                       "  -T, --timeout S         Tempo máximo de espera por cada resposta (por omissão %d s)\n"
+                       "  -f, --pairs FICHEIRO    Pares \"nif senha\", um por linha (e.g., gerados por bd_generate --pairs)\n"
+                       "  -b, --database BD       BD de onde são lidos os pares, se não houver --pairs (por omissão %s)\n"
+                       "  -t, --text-protocol     Envia os pedidos no formato de texto original\n"
+                       "  -R, --ring              Envia os pedidos pelo anel em memória partilhada (Servidor com --ring)\n",
+                       argv[0], config.total, config.concurrency, MAX_ESPERA, FILE_DATABASE);
+                exit(1);
+        }
+    }
+    if (config.total <= 0 || config.concurrency <= 0 || config.rate < 0 || config.timeout <= 0 ||
+            (config.ring && config.textProtocol)) {
+        so_error("LOADGEN", "Valores inválidos");
+        exit(1);
+    }
+}
+
+int main (int argc, char *argv[]) {
+    parseArguments(argc, argv);
+    loadPairs();
+    if (config.concurrency > (long) nPairs)
+        config.concurrency = nPairs;     // Cada NIF só pode ter um pedido em curso
+    if (!(latencies = malloc(config.total * sizeof(double)))) {
+        so_error("LOADGEN", "Sem memória");
+        exit(1);
+    }
+
+    // C1 + C2: o Servidor responde por sinais se não conseguir escrever no FIFO de resposta
+    requestFifoCheck(FILE_REQUESTS);
+    signal(SIGUSR1, trataSinalResposta);
+    signal(SIGHUP, trataSinalResposta);
+    signal(SIGPIPE, SIG_IGN);
+    int replyFd = createReplyFifo();
+    int requestFd = open(FILE_REQUESTS, O_WRONLY);
+    if (requestFd == -1) {
+        so_error("C5", "Erro ao abrir o FIFO %s", FILE_REQUESTS);
+        unlink(replyFifo);
+        exit(1);
+    }
+    RequestRing *ring = NULL;
+    if (config.ring && !(ring = requestRingOpen(requestFd))) {
+        so_error("C5", "O Servidor não criou o anel de pedidos (--ring)");
+        unlink(replyFifo);
+        exit(1);
+    }
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, receiveReplies, &replyFd);
+
+    // C5: envia os pedidos, percorrendo os pares em ciclo e saltando os que ainda têm um pedido em curso ou sem resposta
+    double begin = now();
+    size_t next = 0;
+    long sent, sentByFifo = 0;
+    for (sent = 0; sent < config.total; sent++) {
+        if (config.rate > 0) {           // Ritmo constante (carga aberta): o envio i acontece em begin + i / rate
+            double wait = begin + sent / config.rate - now();
+            if (wait > 0)
+                nanosleep(&(struct timespec) { (time_t) wait, (long) ((wait - (time_t) wait) * 1e9) }, NULL);
+        }
+
+        pthread_mutex_lock(&lock);
+        double idleSince = now();
+        while (inFlight >= config.concurrency || inFlight + nExpired >= (long) nPairs) {
+            if (inFlight > 0)
+                idleSince = now();
+            else if (now() - idleSince > config.timeout)
+                break;                   // Todos os pares esperam há config.timeout por respostas que não chegam
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOADGEN_SWEEP_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&replied, &lock, &deadline);
+            if (now() >= nextSweep)      // Mesmo que as respostas acordem o envio antes do fim de cada espera
+                expireRequests();
+        }
+        if (inFlight + nExpired >= (long) nPairs) {
+            pthread_mutex_unlock(&lock);
+            so_error("LOADGEN", "Nenhum par disponível: %ld pedidos sem resposta", nExpired);
+            break;
+        }
+        while (pairs[next].start > 0 || pairs[next].expired)
+            next = (next + 1) % nPairs;
+        Pair *pair = &pairs[next];
+        next = (next + 1) % nPairs;
+        startRequest(pair);
+        pthread_mutex_unlock(&lock);
+
+        CheckIn request = { .nif = pair->nif, .pidCliente = getpid() };
+        memcpy(request.senha, pair->senha, sizeof(request.senha));
+        if (ring && requestRingWrite(ring, requestFd, request) == 0)
+            continue;
+        sentByFifo++;
+        if (requestWrite(requestFd, request, config.textProtocol) == -1) {
+            so_error("C5", "Erro na escrita do FIFO %s", FILE_REQUESTS);
+            break;
+        }
+    }
+
+    // C7: espera pelas respostas que faltam, ou pelo seu timeout
+    pthread_mutex_lock(&lock);
+    while (inFlight > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&replied, &lock, &deadline);
+        expireRequests();
+    }
+    double elapsed = now() - begin;
+    pthread_mutex_unlock(&lock);
+    close(requestFd);
+    unlink(replyFifo);
+
+    qsort(latencies, nLatencies, sizeof(double), compareDoubles);
+#define PERCENTILE(p) (nLatencies ? latencies[(long) ((p) * (nLatencies - 1))] * 1000 : 0)
+    printf("Pedidos:    %ld enviados, %ld respondidos em %.3f s (%.1f respostas/s), concorrência %d, %ld pares\n",
+           sent, nOk + nFailed, elapsed, (nOk + nFailed) / elapsed, config.concurrency, (long) nPairs);
+    printf("C8 sucesso: %ld\n", nOk);
+    printf("C9 erro:    %ld (NIF inexistente %ld, senha errada %ld, erro no Servidor %ld)\n",
+           nFailed, failedBy[REPLY_NOT_FOUND], failedBy[REPLY_WRONG_PASSWORD], failedBy[REPLY_ERROR]);
+    printf("C11 timeout: %ld (%ld respostas chegaram depois; respostas por sinal: %ld SIGUSR1, %ld SIGHUP)\n",
+           nTimeouts, nLate, atomic_load(&signalsOk), atomic_load(&signalsFailed));
+    if (ring)
+        printf("Anel:       %ld pedidos pelo anel, %ld pelo FIFO\n", sent - sentByFifo, sentByFifo);
+    printf("Latência:   p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, máx %.3f ms, %ld timeouts (> %.1f s, não incluídos)\n",
+           PERCENTILE(0.50), PERCENTILE(0.99), PERCENTILE(0.999), PERCENTILE(1.0), nTimeouts, config.timeout);
+    return nTimeouts > 0 || sent < config.total;
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: pidset.c
+ ** Descrição/Explicação do Módulo:
+ **     Implementação do conjunto de PIDs (ver pidset.h). Sondagem linear, com a
+ **     ocupação limitada a 50%, e remoção por deslocamento das entradas seguintes
+ **     (sem marcas de entrada apagada), pelo que pidSetRemove() pode ser chamada
+ **     num manipulador de sinais enquanto o conjunto não estiver a ser alterado.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "common.h"
+#include <stdint.h>
+#include "pidset.h"
+
+/**
+ * @brief Posição inicial de pid numa tabela com nSlots entradas (hash de Fibonacci: os bits de cima do produto, que
+ *        dependem de todos os bits do PID, como em bd_index.c)
+ */
+static size_t pidSetHash (pid_t pid, size_t nSlots) {
+    return ((uint32_t) pid * 2654435769u) >> (32 - __builtin_ctzl(nSlots));
+}
+
+/**
+ * @brief Posição de pid na tabela, ou da entrada livre onde deveria ser inserido
+ */
+static size_t pidSetFind (const PidSet *set, pid_t pid) {
+    size_t i = pidSetHash(pid, set->nSlots);
+    while (set->slots[i] != 0 && set->slots[i] != pid)
+        i = (i + 1) & (set->nSlots - 1);
+    return i;
+}
+
+/**
+ * @brief Duplica (ou cria) a tabela e volta a inserir os PIDs existentes
+ * @return int 0 em caso de sucesso, -1 se não houver memória
+ */
+static int pidSetGrow (PidSet *set) {
+    PidSet bigger = { .nSlots = set->nSlots ? set->nSlots * 2 : PIDSET_MIN_SLOTS, .count = set->count };
+    if (!(bigger.slots = calloc(bigger.nSlots, sizeof(pid_t))))
+        return -1;
+    for (size_t i = 0; i < set->nSlots; i++)
+        if (set->slots[i] != 0)
+            bigger.slots[pidSetFind(&bigger, set->slots[i])] = set->slots[i];
+    free(set->slots);
+    *set = bigger;
+    return 0;
+}
+
+/**
+ * @brief Acrescenta pid ao conjunto (se ainda não estiver)
+ * @return int 0 em caso de sucesso, -1 se não houver memória
+ */
+int pidSetAdd (PidSet *set, pid_t pid) {
+    if ((set->count + 1) * 2 > set->nSlots && pidSetGrow(set) == -1)
+        return -1;
+    size_t i = pidSetFind(set, pid);
+    if (set->slots[i] == 0) {
+        set->slots[i] = pid;
+        set->count++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Retira pid do conjunto, deslocando para trás as entradas da mesma sequência de sondagem
+ * @return int TRUE se pid estava no conjunto
+ */
+int pidSetRemove (PidSet *set, pid_t pid) {
+    if (set->count == 0)
+        return FALSE;
+    size_t mask = set->nSlots - 1, hole = pidSetFind(set, pid);
+    if (set->slots[hole] == 0)
+        return FALSE;
+
+    for (size_t i = (hole + 1) & mask; set->slots[i] != 0; i = (i + 1) & mask) {
+        size_t home = pidSetHash(set->slots[i], set->nSlots);
+        // A entrada i pode ocupar o buraco se a sua posição inicial não estiver entre o buraco e i (circularmente)
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            set->slots[hole] = set->slots[i];
+            hole = i;
+        }
+    }
+    set->slots[hole] = 0;
+    set->count--;
+    return TRUE;
+}
+
+/**
+ * @return int TRUE se pid pertence ao conjunto
+ */
+int pidSetContains (const PidSet *set, pid_t pid) {
+    return set->count > 0 && set->slots[pidSetFind(set, pid)] == pid;
+}
@@ -0,0 +1,30 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: pidset.h
+ ** Descrição/Explicação do Módulo:
+ **     Conjunto de PIDs (tabela de hash com endereçamento aberto) usado pelo Servidor
+ **     para saber, sem consultar a BD, que Servidores Dedicados estão vivos
+ **
+ ******************************************************************************/
+#ifndef __PIDSET_H__
+#define __PIDSET_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define PIDSET_MIN_SLOTS 64     // Nº inicial de entradas da tabela (potência de 2)
+
+typedef struct {
+    pid_t  *slots;              // Tabela de PIDs (0 = entrada livre)
+    size_t  nSlots;             // Nº de entradas da tabela (sempre potência de 2)
+    size_t  count;              // Nº de PIDs no conjunto
+} PidSet;
+
+int  pidSetAdd (PidSet *, pid_t);       // Acrescenta um PID (0, ou -1 se não houver memória)
+int  pidSetRemove (PidSet *, pid_t);    // Retira um PID (TRUE se estava no conjunto). Nunca realoca memória
+int  pidSetContains (const PidSet *, pid_t);
+
+/* Percorre os PIDs do conjunto: for (size_t i = 0; i < set.nSlots; i++) if (set.slots[i] > 0) ... */
+
+#endif  // __PIDSET_H__
@@ -0,0 +1,64 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: procutil.h
+ ** Descrição/Explicação do Módulo:
+ **     Primitivas de processos partilhadas pelos módulos do Servidor: a espera e o
+ **     despertar num futex (entre processos, em memória partilhada, ou entre as
+ **     threads de --threads) e a criação dos processos de segundo plano do passo S1
+ **     (o flusher de --durability group e o sweeper de --sweep)
+ **
+ ******************************************************************************/
+#ifndef __PROCUTIL_H__
+#define __PROCUTIL_H__
+
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define FUTEX_SHARED 0                       // flags de um futex em memória partilhada (MAP_SHARED) entre processos;
+                                             // FUTEX_PRIVATE_FLAG para um futex entre as threads de um só processo
+
+/**
+ * @brief Espera em word enquanto este valer value, no máximo timeoutMicros µs (-1 = sem limite). Pode acordar
+ *        mais cedo (sinal, ou um despertar de outra espera): quem chama volta a verificar a condição
+ */
+static inline void futexWait (atomic_uint *word, unsigned value, long timeoutMicros, int flags) {
+    struct timespec timeout = { timeoutMicros / 1000000, (timeoutMicros % 1000000) * 1000 };
+    syscall(SYS_futex, word, FUTEX_WAIT | flags, value, timeoutMicros < 0 ? NULL : &timeout, NULL, 0);
+}
+
+/**
+ * @brief Acorda até n dos que esperam em word (INT_MAX: todos)
+ */
+static inline void futexWake (atomic_uint *word, int n, int flags) {
+    syscall(SYS_futex, word, FUTEX_WAKE | flags, n, NULL, NULL, 0);
+}
+
+/**
+ * @brief fork() de um processo de segundo plano do Servidor. O filho termina com o Servidor (SIGTERM), mesmo que
+ *        este tenha terminado antes do prctl(), ignora o Ctrl+C e não herda o handler de SIGCHLD do Servidor
+ * @return pid_t Como o fork(): o PID do filho no Servidor, 0 no filho, -1 em caso de erro
+ */
+static inline pid_t forkBackground () {
+    pid_t parent = getpid();
+    fflush(stdout);                  // O filho não volta a escrever o que ainda está no buffer
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent)
+        exit(0);
+    signal(SIGINT, SIG_IGN);         // O Ctrl+C no terminal é para o Servidor (S6)
+    signal(SIGCHLD, SIG_DFL);
+    return 0;
+}
+
+#endif  // __PROCUTIL_H__
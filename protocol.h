@@ -0,0 +1,165 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: protocol.h
+ ** Descrição/Explicação do Módulo:
+ **     Formato binário dos pedidos enviados pelo Cliente ao Servidor através do
+ **     FIFO FILE_REQUESTS. Cada pedido é uma trama de tamanho fixo, menor do que
+ **     PIPE_BUF, pelo que cada write() é atómico mesmo com vários Clientes em
+ **     simultâneo, e o Servidor descodifica-a sem qualquer parsing de texto.
+ **     O protocolo de texto original ("%d\n%s\n%d\n") continua disponível com
+ **     a opção --text-protocol, no Cliente e no Servidor.
+ **     Define também as respostas (ReplyFrame) escritas pelo Servidor Dedicado no
+ **     FIFO privado de cada Cliente.
+ **
+ ******************************************************************************/
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include "common.h"
+
+#define REQUEST_MAGIC   0x51524649  // "IFRQ" em little-endian
+#define REQUEST_VERSION 1
+
+typedef struct {
+    uint32_t magic;             // REQUEST_MAGIC
+    uint16_t version;           // REQUEST_VERSION
+    uint16_t length;            // Tamanho da trama (sizeof(RequestFrame))
+    int32_t  nif;               // Número de contribuinte do passageiro
+    char     senha[40];         // Senha do passageiro (terminada em '\0')
+    int32_t  pidCliente;        // PID do processo Cliente
+} RequestFrame;
+
+_Static_assert(sizeof(RequestFrame) <= PIPE_BUF, "RequestFrame tem de ser escrita atomicamente no FIFO");
+
+/**
+ * @brief Preenche a trama correspondente ao pedido request
+ */
+static inline void requestFrameEncode (CheckIn request, RequestFrame *frame) {
+    memset(frame, 0, sizeof(RequestFrame));
+    frame->magic = REQUEST_MAGIC;
+    frame->version = REQUEST_VERSION;
+    frame->length = sizeof(RequestFrame);
+    frame->nif = request.nif;
+    strncpy(frame->senha, request.senha, sizeof(frame->senha) - 1);
+    frame->pidCliente = request.pidCliente;
+}
+
+/**
+ * @brief Valida a trama e copia os seus campos para request
+ * @return int 0 se a trama for válida, -1 caso contrário
+ */
+static inline int requestFrameDecode (const RequestFrame *frame, CheckIn *request) {
+    if (frame->magic != REQUEST_MAGIC || frame->version != REQUEST_VERSION || frame->length != sizeof(RequestFrame) ||
+            frame->nif <= 0 || frame->pidCliente <= 0 || !memchr(frame->senha, '\0', sizeof(frame->senha)))
+        return -1;
+    request->nif = frame->nif;
+    memcpy(request->senha, frame->senha, sizeof(frame->senha));
+    request->pidCliente = frame->pidCliente;
+    return 0;
+}
+
+/**
+ * @brief Envia o pedido request para o FIFO do servidor já aberto em fd, numa única escrita atómica
+ * @param textProtocol TRUE para usar o formato de texto original ("%d\n%s\n%d\n") em vez de RequestFrame
+ * @return ssize_t O resultado de write()
+ */
+static inline ssize_t requestWrite (int fd, CheckIn request, int textProtocol) {
+    if (textProtocol) {
+        char buffer[sizeof(CheckIn)];
+        int length = snprintf(buffer, sizeof(buffer), "%d\n%s\n%d\n", request.nif, request.senha, request.pidCliente);
+        return write(fd, buffer, length);
+    }
+    RequestFrame frame;
+    requestFrameEncode(request, &frame);
+    return write(fd, &frame, sizeof(frame));     // sizeof(frame) <= PIPE_BUF
+}
+
+/**
+ * Resposta do Servidor Dedicado ao Cliente, escrita no FIFO privado do Cliente ("<pidCliente>.fifo").
+ * Substitui os sinais SIGUSR1 (sucesso) e SIGHUP (erro), que continuam a ser usados se o Cliente não
+ * tiver criado o seu FIFO de resposta.
+ */
+#define REPLY_MAGIC   0x50524649    // "IFRP" em little-endian
+#define REPLY_VERSION 2
+
+enum {
+    REPLY_OK = 0,                   // Check-in concluído com sucesso
+    REPLY_NOT_FOUND,                // NIF inexistente na BD
+    REPLY_WRONG_PASSWORD,           // Senha errada
+    REPLY_ERROR                     // Erro no acesso à BD
+};
+
+typedef struct {
+    uint32_t magic;                 // REPLY_MAGIC
+    uint16_t version;               // REPLY_VERSION
+    uint16_t length;                // Tamanho da trama (sizeof(ReplyFrame))
+    int32_t  status;                // REPLY_OK, ou o motivo do erro
+    int32_t  nif;                   // NIF do pedido a que se responde
+    char     nome[60];              // Nome do passageiro (só em caso de sucesso)
+    char     nrVoo[8];              // Número do voo (só em caso de sucesso)
+    int32_t  pidServidorDedicado;   // PID do Servidor Dedicado que tratou o pedido
+    uint32_t lookupMicros;          // Duração de SD10 (pesquisa na BD), em µs
+    uint32_t checkinMicros;         // Duração de SD11 (escrita na BD), em µs
+    uint32_t delayMicros;           // Tempo de processamento simulado em SD12 (--delay), em µs
+    uint32_t totalMicros;           // Tempo desde o início do Servidor Dedicado até à resposta, em µs
+} ReplyFrame;
+
+_Static_assert(sizeof(ReplyFrame) <= PIPE_BUF, "ReplyFrame tem de ser escrita atomicamente no FIFO");
+
+/**
+ * @brief C1 Verifica que o FIFO do servidor nameFifo existe e é um FIFO, e termina o processo caso contrário.
+ *        Usada pelo Cliente e pelo loadgen
+ */
+static inline void requestFifoCheck (const char *nameFifo) {
+    struct stat statbuf;
+    if (access(nameFifo, F_OK) != -1) {
+        if (stat(nameFifo, &statbuf) == -1) {
+            so_error("C1", "Erro ao obter informações sobre o arquivo '%s'", nameFifo);
+            exit(1);
+        }
+        if ((statbuf.st_mode & S_IFMT) == S_IFIFO) {
+            so_success("C1", "O ficheiro existe e é um FIFO.");
+        } else {
+            so_error("C1", "O arquivo '%s' não é um FIFO.", nameFifo);
+            exit(1);
+        }
+    } else {
+        so_error("C1", "O ficheiro '%s' não existe!", nameFifo);
+        exit(1);
+    }
+}
+
+/**
+ * @brief Nome do FIFO de resposta do Cliente com o PID dado (e.g., "1234.fifo")
+ */
+static inline void replyFifoName (int pidCliente, char *buffer, size_t size) {
+    snprintf(buffer, size, "%d%s", pidCliente, FILE_SUFFIX_FIFO);
+}
+
+/**
+ * @brief Descrição do motivo de uma resposta sem sucesso (C9)
+ */
+static inline const char *replyStatusText (int status) {
+    switch (status) {
+        case REPLY_OK:             return "sucesso";
+        case REPLY_NOT_FOUND:      return "NIF inexistente";
+        case REPLY_WRONG_PASSWORD: return "senha errada";
+        default:                   return "erro no Servidor";
+    }
+}
+
+/**
+ * @brief Valida uma resposta lida do FIFO do Cliente
+ * @return int 0 se a trama for válida, -1 caso contrário
+ */
+static inline int replyFrameCheck (const ReplyFrame *reply) {
+    if (reply->magic != REPLY_MAGIC || reply->version != REPLY_VERSION || reply->length != sizeof(ReplyFrame))
+        return -1;
+    return 0;
+}
+
+#endif  // __PROTOCOL_H__
@@ -0,0 +1,132 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: request_ring.h
+ ** Descrição/Explicação do Módulo:
+ **     Anel de pedidos em memória partilhada (--ring), uma alternativa ao FIFO
+ **     FILE_REQUESTS para os pedidos dos Clientes. O Servidor cria o anel no passo
+ **     S2, com um nome derivado do inode do FIFO, pelo que um Cliente que abre o
+ **     FIFO encontra o anel do mesmo Servidor. Cada Cliente reserva uma posição com
+ **     um fetch-add em head e escreve lá a RequestFrame; o Servidor consome as
+ **     posições por ordem, sem chamadas ao sistema. Só quando o Servidor está
+ **     parado à espera de pedidos (sleeping) é que o Cliente o acorda, com um byte
+ **     REQUEST_RING_DOORBELL no FIFO. Se o anel estiver cheio, ou a posição já não
+ **     for do Cliente, o pedido segue pelo FIFO, como sempre.
+ **
+ **     Cada posição tem um nº de sequência (ticket << 2 | estado): FREE (livre para
+ **     o ticket), WRITING (o Cliente está a escrever), READY (pedido completo) ou
+ **     SKIPPED (o Servidor desistiu de um Cliente que não acabou de escrever).
+ **
+ ******************************************************************************/
+#ifndef __REQUEST_RING_H__
+#define __REQUEST_RING_H__
+
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "protocol.h"
+
+#define REQUEST_RING_MAGIC    0x474e4952  // "RING" em little-endian
+#define REQUEST_RING_VERSION  1
+#define REQUEST_RING_SLOTS    4096        // Nº de posições (potência de 2)
+#define REQUEST_RING_DOORBELL '\0'        // Byte escrito no FIFO para acordar o Servidor (nunca inicia uma RequestFrame)
+
+enum { RING_FREE = 0, RING_WRITING, RING_READY, RING_SKIPPED };
+
+#define RING_SEQUENCE(ticket, state) ((uint64_t) (ticket) << 2 | (state))
+
+typedef struct {
+    _Alignas(64) atomic_uint_least64_t sequence; // RING_SEQUENCE(ticket, estado)
+    RequestFrame frame;
+} RequestRingSlot;
+
+typedef struct {
+    uint32_t magic;                    // REQUEST_RING_MAGIC
+    uint16_t version;                  // REQUEST_RING_VERSION
+    uint16_t slotSize;                 // sizeof(RequestRingSlot)
+    uint32_t slots;                    // REQUEST_RING_SLOTS
+    int32_t  serverPid;                // PID do Servidor que criou o anel
+    atomic_int closed;                 // S7: o Servidor já não consome o anel
+    _Alignas(64) atomic_uint_least64_t head; // Próximo ticket a reservar (Clientes)
+    _Alignas(64) atomic_uint_least64_t tail; // Próximo ticket a consumir (Servidor)
+    atomic_int sleeping;               // O Servidor está bloqueado no FIFO e tem de ser acordado
+    _Alignas(64) atomic_long doorbells;  // Nº de vezes que um Cliente acordou o Servidor
+    atomic_long fallbacks;             // Nº de pedidos que seguiram pelo FIFO (anel cheio ou posição perdida)
+    RequestRingSlot slot[REQUEST_RING_SLOTS];
+} RequestRing;
+
+/**
+ * @brief Nome do objeto de memória partilhada (shm_open) do anel do Servidor cujo FIFO tem o stat fifo
+ */
+static inline void requestRingName (const struct stat *fifo, char *buffer, size_t size) {
+    snprintf(buffer, size, "/iscteflight-%lx-%lx", (unsigned long) fifo->st_dev, (unsigned long) fifo->st_ino);
+}
+
+/**
+ * @brief Mapeia o anel do Servidor que tem o FIFO já aberto em fifoFd
+ * @return RequestRing* O anel, ou NULL se o Servidor não tiver sido iniciado com --ring
+ */
+static inline RequestRing *requestRingOpen (int fifoFd) {
+    struct stat fifo, shared;
+    char name[64];
+    if (fstat(fifoFd, &fifo) == -1)
+        return NULL;
+    requestRingName(&fifo, name, sizeof(name));
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return NULL;
+    RequestRing *ring = MAP_FAILED;
+    if (fstat(fd, &shared) == 0 && shared.st_size == sizeof(RequestRing))
+        ring = mmap(NULL, sizeof(RequestRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+        return NULL;
+    if (ring->magic != REQUEST_RING_MAGIC || ring->version != REQUEST_RING_VERSION ||
+            ring->slotSize != sizeof(RequestRingSlot) || ring->slots != REQUEST_RING_SLOTS) {
+        munmap(ring, sizeof(RequestRing));
+        return NULL;
+    }
+    return ring;
+}
+
+/**
+ * @brief Escreve o pedido request no anel, sem chamadas ao sistema, a não ser para acordar o Servidor parado
+ * @param fifoFd O FIFO do servidor, aberto para escrita, onde vai o byte REQUEST_RING_DOORBELL
+ * @return int   0 em caso de sucesso, -1 se o pedido tiver de seguir pelo FIFO
+ */
+static inline int requestRingWrite (RequestRing *ring, int fifoFd, CheckIn request) {
+    uint64_t expected;
+    if (atomic_load(&ring->closed) ||
+            atomic_load_explicit(&ring->head, memory_order_relaxed) - atomic_load(&ring->tail) >= REQUEST_RING_SLOTS)
+        goto fallback;                 // Anel cheio (o Servidor está atrasado): o FIFO tem a sua própria fila
+
+    uint64_t ticket = atomic_fetch_add(&ring->head, 1);
+    RequestRingSlot *slot = &ring->slot[ticket & (REQUEST_RING_SLOTS - 1)];
+    expected = RING_SEQUENCE(ticket, RING_FREE);
+    if (!atomic_compare_exchange_strong(&slot->sequence, &expected, RING_SEQUENCE(ticket, RING_WRITING)))
+        goto fallback;                 // A volta anterior ainda não foi consumida, ou o Servidor já saltou o ticket
+    requestFrameEncode(request, &slot->frame);
+    expected = RING_SEQUENCE(ticket, RING_WRITING);
+    if (!atomic_compare_exchange_strong(&slot->sequence, &expected, RING_SEQUENCE(ticket, RING_READY))) {
+        // O Servidor desistiu da posição (SKIPPED): devolve-a à volta seguinte, se ainda ninguém o fez
+        expected = RING_SEQUENCE(ticket, RING_SKIPPED);
+        atomic_compare_exchange_strong(&slot->sequence, &expected, RING_SEQUENCE(ticket + REQUEST_RING_SLOTS, RING_FREE));
+        goto fallback;
+    }
+
+    // O Servidor marca sleeping antes de voltar a ver head, e o Cliente vê sleeping depois de publicar o pedido:
+    // um dos dois vê sempre o outro. Só um Cliente escreve o byte, o que trocar sleeping de 1 para 0
+    int asleep = 1;
+    char doorbell = REQUEST_RING_DOORBELL;
+    if (atomic_load(&ring->sleeping) && atomic_compare_exchange_strong(&ring->sleeping, &asleep, 0)) {
+        atomic_fetch_add(&ring->doorbells, 1);
+        if (write(fifoFd, &doorbell, 1) == -1)  // O pedido já está no anel: não é reenviado pelo FIFO
+            so_debug("Erro ao acordar o Servidor");
+    }
+    return 0;
+
+fallback:
+    atomic_fetch_add(&ring->fallbacks, 1);
+    return -1;
+}
+
+#endif  // __REQUEST_RING_H__
@@ -8,9 +8,52 @@
 
 #define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
 #include "common.h"
+#include "servidor.h"
+#include "bd.h"
+#include "bd_scan.h"
+#include "bd_journal.h"
+#include "bd_commit.h"
+#include "bd_shard.h"
+#include "protocol.h"
+#include "request_ring.h"
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#define SCAN_CHUNK_RECORDS 512       // Registos lidos de cada vez na pesquisa sequencial com --io stdio (60 KB)
+
+void parseArguments (int, char *[]);
+static int decodeRequest (const char *, int, CheckIn *);
+static int decodeBufferedRequests (char *, int *, CheckIn *, int);
+static int readRecordDB (Bd *, FILE *, int, CheckIn *);
+static void syncIndexDB (Bd *, char *, int, int);
+static void sendReply (const CheckIn *, int);
+static int parseDelay (const char *, DelayModel *);
+static double processingDelayMs ();
+static void createStats ();
+static void deferHandlers (int);
+static void scanShardsDB ();
 
 /*** Variáveis Globais ***/
 CheckIn clientRequest; // Variável que tem o pedido enviado do Cliente para o Servidor
+static _Thread_local CheckIn *currentRequest;  // O pedido tratado por runServidorDedicado(): clientRequest, ou o de uma thread
+// Estado de cada pedido, com uma cópia por thread (--threads); nos processos, há uma só thread
+static _Thread_local int indexSyncPending;  // SD10 não encontrou o cliente no índice da BD, pelo que SD11 deve acrescentá-lo
+ServidorConfig config; // Configuração do Servidor, preenchida por parseArguments()
+int requestFifo = -1;       // FIFO do servidor, aberto para leitura durante toda a vida do Servidor (S2)
+int requestFifoWriter = -1; // Escritor auxiliar do FIFO, para que a leitura nunca devolva EOF
+PidSet liveServidores; // PIDs dos Servidores Dedicados vivos, para o shutdown (S6) não depender da BD
+static ServidorStats localStats;      // Estatísticas até createStats(): os passos também podem ser chamados sem main()
+ServidorStats *stats = &localStats;   // Estatísticas partilhadas com os Servidores Dedicados (MAP_SHARED | MAP_ANONYMOUS)
+_Thread_local sigjmp_buf *requestEnd; // Nos Servidores Dedicados do pool (e nas threads), é para aqui que exitServidorDedicado() regressa
+static _Thread_local struct timespec requestStart;  // Início do pedido atual no Servidor Dedicado (SD9)
+static _Thread_local uint32_t lookupMicros, checkinMicros, delayMicros; // Duração de SD10, SD11 e da espera de SD12 no pedido atual, enviadas ao Cliente
+static BdHeader dbHeader;             // Cabeçalho da BD, validado em S1 (ver bd_format.h); com --shards, o do 1º ficheiro
+static char *shardNames[BD_SHARDS_MAX] = { FILE_DATABASE }; // Os ficheiros da BD: só FILE_DATABASE, ou os de --shards
+static int nShards = 1;
+static int handlersDeferred = FALSE;  // No CICLO1, SIGINT e SIGCHLD só são entregues durante a espera em S4 (ver deferHandlers())
+static volatile sig_atomic_t shutdownPending = FALSE; // --threads no CICLO1: SIGINT recebido, S6 corre em S4 (fora do handler)
 
 /**
  * @brief Processamento do processo Servidor e dos processos Servidor Dedicado
@@ -18,61 +61,387 @@ CheckIn clientRequest; // Variável que tem o pedido enviado do Cliente para o S
  *         Deverão, sim, completar as funções seguintes à main(), nos locais onde está claramente assinalado
  *         '// Substituir este comentário pelo código da função a ser implementado pelo aluno' "
  */
-int main () {
+int main (int argc, char *argv[]) {
+    parseArguments(argc, argv);
+    createStats();
     // S1
     checkExistsDB_S1(FILE_DATABASE);
     // S2
     createFifo_S2(FILE_REQUESTS);
     // S3
     triggerSignals_S3(FILE_REQUESTS);
-
-    int indexClient;       // Índice do cliente que fez o pedido ao servidor/servidor dedicado na BD
+    if (config.eventLoop)
+        initEventLoop();
+    if (config.poolSize > 0)
+        createPool();
+    if (config.threads > 0)
+        createThreads();
+    if (config.eventLoop)
+        runEventLoop();    // Substitui o CICLO1 e nunca regressa
 
     // S4: CICLO1
+    handlersDeferred = TRUE;               // S6 e S8 só correm enquanto S4 espera por pedidos
+    deferHandlers(SIG_BLOCK);
+    CheckIn requests[REQUEST_BATCH_MAX];   // Lote de pedidos lidos do FIFO numa só leitura
     while (TRUE) {
         // S4
-        clientRequest = readRequest_S4(FILE_REQUESTS); // S4: "Se houver erro (...) clientRequest.nif == -1"
-        if (clientRequest.nif < 0)   // S4: "Se houver erro na abertura do FIFO ou na leitura do mesmo, (...)"
-            continue;                // S4: "(...) e recomeça o Ciclo1 neste mesmo passo S4, lendo um novo pedido"
+        int numRequests = readRequestBatch_S4(FILE_REQUESTS, requests, REQUEST_BATCH_MAX);
+        for (int i = 0; i < numRequests; i++) {
+            clientRequest = requests[i];
+
+            // S5 (com --threads, o pedido vai para a fila das threads; com --prefork, para um Servidor Dedicado
+            // livre do pool; se não houver, faz fork())
+            if (dispatchThreads(clientRequest) == 0 || dispatchPool(clientRequest) == 0)
+                continue;
+            int pidServidorDedicado = createServidorDedicado_S5();
+            if (pidServidorDedicado > 0) // S5: "o processo Servidor (pai) (...)"
+                continue;                // S5: "(...) segue para o pedido seguinte do lote, ou volta a aguardar novo pedido em S4"
+            // S5: "o Servidor Dedicado (que tem o PID pidServidorDedicado) segue para o passo SD9"
+            runServidorDedicado(&clientRequest);
+        }
+    }
+}
 
-        // S5
-        int pidServidorDedicado = createServidorDedicado_S5();
-        if (pidServidorDedicado > 0) // S5: "o processo Servidor (pai) (...)"
-            continue;                // S5: "(...) recomeça o Ciclo1 no passo S4 (ou seja, volta a aguardar novo pedido)"
-        // S5: "o Servidor Dedicado (que tem o PID pidServidorDedicado) segue para o passo SD9"
+/**
+ * @brief Processamento de um pedido por um Servidor Dedicado: passos SD9 a SD13
+ * @param request O pedido: clientRequest num processo, ou o pedido da thread (--threads)
+ */
+void runServidorDedicado (CheckIn *request) {
+    int indexClient;       // Índice do cliente que fez o pedido ao servidor/servidor dedicado na BD
+    char *nameDB = shardNames[config.shards ? bdShardOf(request->nif, nShards) : 0]; // --shards: o ficheiro do NIF
+
+    currentRequest = request;
+    if (!inThread())       // Uma thread partilha o FIFO, os sinais e o ciclo de eventos com o Servidor
+        detachServidorDedicado();
+    clock_gettime(CLOCK_MONOTONIC, &requestStart);
+    lookupMicros = checkinMicros = delayMicros = 0;
+
+    // SD9
+    triggerSignals_SD9();
+    // SD10
+    CheckIn itemBD;
+    indexClient = searchClientDB_SD10(*request, nameDB, &itemBD);
+    lookupMicros = elapsedMicros(&requestStart);
+    // SD11
+    checkinClientDB_SD11(request, nameDB, indexClient, itemBD);
+    checkinMicros = elapsedMicros(&requestStart) - lookupMicros;
+    // SD12
+    sendAckCheckIn_SD12(request->pidCliente);
+    // SD13
+    closeSessionDB_SD13(*request, nameDB, indexClient);
+    so_exit_on_error(-1, "ERRO: O servidor dedicado nunca devia chegar a este ponto");
+}
+
+/**
+ * @brief Tempo decorrido desde since, em microssegundos
+ */
+uint32_t elapsedMicros (const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000 + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+/**
+ * @brief Termina o pedido atual do Servidor Dedicado. Um Servidor Dedicado criado por S5 termina
+ *        com exit(); um Servidor Dedicado do pool regressa a requestEnd para tratar o pedido seguinte
+ * @param status O código de saída do Servidor Dedicado
+ */
+void exitServidorDedicado (int status) {
+    if (requestEnd)
+        siglongjmp(*requestEnd, status + 1);
+    exit(status);
+}
 
-        // SD9
-        triggerSignals_SD9();
-        // SD10
-        CheckIn itemBD;
-        indexClient = searchClientDB_SD10(clientRequest, FILE_DATABASE, &itemBD);
-        // SD11
-        checkinClientDB_SD11(&clientRequest, FILE_DATABASE, indexClient, itemBD);
-        // SD12
-        sendAckCheckIn_SD12(clientRequest.pidCliente);
-        // SD13
-        closeSessionDB_SD13(clientRequest, FILE_DATABASE, indexClient);
-        so_exit_on_error(-1, "ERRO: O servidor dedicado nunca devia chegar a este ponto");
+/**
+ * @brief Lê as opções da linha de comandos para a variável global config
+ * @param argc Nº de argumentos
+ * @param argv Argumentos
+ */
+void parseArguments (int argc, char *argv[]) {
+    static struct option options[] = {
+        { "io", required_argument, NULL, 'i' },
+        { "journal", no_argument, NULL, 'j' },
+        { "durability", required_argument, NULL, 'D' },
+        { "mmap", no_argument, NULL, 'm' },
+        { "prefork", required_argument, NULL, 'p' },
+        { "recycle", required_argument, NULL, 'r' },
+        { "threads", required_argument, NULL, 'T' },
+        { "text-protocol", no_argument, NULL, 't' },
+        { "ring", no_argument, NULL, 'R' },
+        { "event-loop", no_argument, NULL, 'e' },
+        { "delay", required_argument, NULL, 'd' },
+        { "shards", required_argument, NULL, 'S' },
+        { "sweep", required_argument, NULL, 'w' },
+        { "quick-shutdown", no_argument, NULL, 'q' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option;
+
+    config.poolRecycle = POOL_RECYCLE_DEFAULT;
+    config.delay = (DelayModel) { DELAY_UNIFORM, 1000, MAX_ESPERA * 1000 };
+    while ((option = getopt_long(argc, argv, "i:jD:mp:r:T:tRed:S:w:qh", options, NULL)) != -1) {
+        switch (option) {
+            case 'j': config.journal = TRUE; break;
+            case 'm': config.io = BD_IO_MMAP; break;
+            case 'p': config.poolSize = atoi(optarg); break;
+            case 'r': config.poolRecycle = atoi(optarg); break;
+            case 'T': config.threads = atoi(optarg); break;
+            case 't': config.textProtocol = TRUE; break;
+            case 'R': config.ring = TRUE; break;
+            case 'e': config.eventLoop = TRUE; break;
+            case 'S': config.shards = atoi(optarg); break;
+            case 'w': config.sweepRate = atoi(optarg); break;
+            case 'q': config.quickShutdown = TRUE; break;
+            case 'i':
+                if (!strcmp(optarg, "pread") || !strcmp(optarg, "stdio") || !strcmp(optarg, "mmap")) {
+                    config.io = optarg[0] == 'p' ? BD_IO_PREAD : optarg[0] == 's' ? BD_IO_STDIO : BD_IO_MMAP;
+                    break;
+                }
+                so_error("", "Modo de acesso à BD inválido: %s", optarg);
+                goto usage;
+            case 'D':
+                if (bdDurabilityParse(optarg, &config.durability) == 0)
+                    break;
+                so_error("", "Modo de durabilidade inválido: %s", optarg);
+                goto usage;
+            case 'd':
+                if (parseDelay(optarg, &config.delay) == 0)
+                    break;
+                so_error("", "Modelo de espera inválido: %s", optarg);
+                // fall through
+            default:
+            usage:
+                printf("Uso: %s [opções]\n"
+                       "  -i, --io MODO           Acesso aos registos da BD: pread (por omissão; BD aberta uma vez em S1,\n"
+                       "                          pread()/pwrite() por registo), stdio (fopen()/fread() por pedido) ou mmap\n"
+                       "  -j, --journal           Diário das sessões (bd_passageiros.dat.journal), com group commit; em S1,\n"
+                       "                          repara as sessões de Servidores Dedicados que morreram entre SD11 e SD13\n"
+                       "  -D, --durability MODO   Quando um check-in (SD11) fica em disco: none (por omissão, page cache),\n"
+                       "                          record (um fdatasync() por check-in) ou group[:MS[,K]] (um único flusher\n"
+                       "                          faz o fdatasync() com K check-ins pendentes, ou MS ms após o primeiro;\n"
+                       "                          por omissão group:%d,%d)\n"
+                       "  -m, --mmap              O mesmo que --io mmap: mapeia a BD em memória, partilhada com os Servidores Dedicados\n"
+                       "  -p, --prefork N         Cria N Servidores Dedicados no arranque, que tratam os pedidos em vez de um fork() por pedido\n"
+                       "  -r, --recycle M         Substitui cada Servidor Dedicado do pool após M pedidos (0 = nunca; por omissão %d)\n"
+                       "  -T, --threads N         Trata os pedidos em N threads do Servidor, em vez de um processo por pedido;\n"
+                       "                          implica --io pread, se for stdio\n"
+                       "  -t, --text-protocol     Lê os pedidos no formato de texto original, em vez de tramas binárias\n"
+                       "  -R, --ring              Cria em S2 um anel de pedidos em memória partilhada, lido antes do FIFO,\n"
+                       "                          para os Clientes com --ring; o FIFO continua a receber os outros pedidos\n"
+                       "  -e, --event-loop        Trata pedidos, sinais e fim dos Servidores Dedicados num ciclo epoll\n"
+                       "  -d, --delay MODELO      Tempo de processamento simulado em SD12, em ms: none, fixed:MS,\n"
+                       "                          uniform:MIN-MAX ou exp:MÉDIA (por omissão uniform:1000-%d)\n"
+                       "  -S, --shards N          A BD está repartida pelos ficheiros bd_passageiros.dat.shard0..N-1, pelo\n"
+                       "                          hash do NIF (criados com bd_reshard); implica --io pread, se for stdio\n"
+                       "  -w, --sweep N           Limpa, em segundo plano e a N registos por segundo, as sessões de\n"
+                       "                          Servidores Dedicados que já não existem (zombies e PIDs de outros programas incluídos)\n"
+                       "  -q, --quick-shutdown    No shutdown (S6), só avisa os Servidores Dedicados que o Servidor conhece,\n"
+                       "                          sem percorrer a BD à procura de outras sessões abertas\n",
+                       argv[0], BD_COMMIT_INTERVAL_MS, BD_COMMIT_BATCH, POOL_RECYCLE_DEFAULT, MAX_ESPERA * 1000);
+                exit(option == 'h' ? 0 : 1);
+        }
+    }
+    if (config.poolSize < 0 || config.poolRecycle < 0 || config.threads < 0 || config.sweepRate < 0 ||
+            config.shards < 0 || config.shards > BD_SHARDS_MAX) {
+        so_error("", "Valores inválidos para --prefork/--recycle/--threads/--sweep/--shards");
+        exit(1);
+    }
+    if (config.threads && config.poolSize) {
+        so_error("", "--threads não pode ser usado com --prefork");
+        exit(1);
+    }
+    if (config.ring && config.textProtocol) {   // O anel só leva RequestFrame, e o byte que acorda o Servidor também
+        so_error("", "--ring não pode ser usado com --text-protocol");
+        exit(1);
+    }
+    if (config.shards && config.journal) {    // As entradas do diário só têm o índice do registo, não o ficheiro
+        so_error("", "--journal não pode ser usado com --shards");
+        exit(1);
     }
 }
 
+/**
+ * @brief Interpreta o modelo de espera de --delay: none, fixed:MS, uniform:MIN-MAX ou exp:MÉDIA (em ms)
+ * @param text  O argumento da opção
+ * @param delay O modelo a preencher
+ * @return int  0 em caso de sucesso, -1 se o modelo for inválido
+ */
+static int parseDelay (const char *text, DelayModel *delay) {
+    double a, b;
+    char end;
+
+    if (!strcmp(text, "none"))
+        *delay = (DelayModel) { DELAY_NONE, 0, 0 };
+    else if (sscanf(text, "fixed:%lf%c", &a, &end) == 1 && a >= 0)
+        *delay = (DelayModel) { DELAY_FIXED, a, a };
+    else if (sscanf(text, "uniform:%lf-%lf%c", &a, &b, &end) == 2 && a >= 0 && b >= a)
+        *delay = (DelayModel) { DELAY_UNIFORM, a, b };
+    else if (sscanf(text, "exp:%lf%c", &a, &end) == 1 && a >= 0)
+        *delay = (DelayModel) { DELAY_EXP, a, a };
+    else
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Sorteia o tempo de processamento de um pedido segundo config.delay. O gerador é semeado uma vez
+ *        por processo, ou por thread (com o PID ou o TID e o relógio), para que os Servidores Dedicados não
+ *        esperem todos o mesmo
+ * @return double O tempo de espera, em milissegundos
+ */
+static double processingDelayMs () {
+    static _Thread_local unsigned short seed[3];
+    static _Thread_local pid_t seedPid = 0;
+
+    if (seedPid != servidorDedicadoId()) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        seedPid = servidorDedicadoId();
+        seed[0] = seedPid;
+        seed[1] = now.tv_nsec;
+        seed[2] = now.tv_nsec >> 16 ^ now.tv_sec;
+    }
+    switch (config.delay.kind) {
+        case DELAY_FIXED:   return config.delay.minMs;
+        case DELAY_UNIFORM: return config.delay.minMs + erand48(seed) * (config.delay.maxMs - config.delay.minMs);
+        case DELAY_EXP:     return -config.delay.minMs * log(1.0 - erand48(seed));
+        default:            return 0;
+    }
+}
+
+/**
+ * @brief Cria as estatísticas em memória partilhada, herdada por todos os Servidores Dedicados
+ */
+static void createStats () {
+    stats = mmap(NULL, sizeof(ServidorStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+        so_error("S1", "Erro ao criar as estatísticas partilhadas");
+        exit(1);
+    }
+    memset(stats, 0, sizeof(ServidorStats));
+}
+
 /**
  *  "O módulo Servidor é responsável pelo processamento do check-in dos passageiros. 
  *   Está dividido em duas partes, um Servidor (pai) e zero ou mais Servidores Dedicados (filhos).
  *   Este módulo realiza as seguintes tarefas:"
  */
 
+typedef struct {
+    int  fd;                         // A BD, aberta para escrita
+    long repaired;                   // Nº de sessões reparadas
+} RepairContext;
+
+/**
+ * @brief Repara uma sessão que o diário deixou aberta (check-in sem fim de sessão, ver bdJournalReplay()): se o
+ *        registo ainda for dessa sessão e o Servidor Dedicado já não existir, os PIDs do registo passam a -1. Um PID
+ *        reutilizado por outro programa, ou um zombie, não conta como Servidor Dedicado (ver servidorDedicadoAlive())
+ * @return int TRUE se a sessão continua aberta (o Servidor Dedicado ainda existe)
+ */
+static int repairSessionDB (const BdJournalEntry *entry, void *context) {
+    RepairContext *repair = context;
+    int32_t pidServidorDedicado, none = -1;
+    if (entry->index >= dbHeader.count || lockRecordDB(repair->fd, entry->index, F_WRLCK) != 0)
+        return FALSE;
+    int inSession = pread(repair->fd, &pidServidorDedicado, sizeof(pidServidorDedicado),
+                     bdFieldOffset(&dbHeader, entry->index, BD_COL_PID_SERVIDOR)) == sizeof(pidServidorDedicado) &&
+               pidServidorDedicado == entry->pidServidorDedicado;   // Senão, o registo já foi limpo, ou reescrito
+    if (inSession && !servidorDedicadoAlive(pidServidorDedicado) &&
+            pwrite(repair->fd, &none, sizeof(none), bdFieldOffset(&dbHeader, entry->index, BD_COL_PID_CLIENTE)) == sizeof(none) &&
+            pwrite(repair->fd, &none, sizeof(none), bdFieldOffset(&dbHeader, entry->index, BD_COL_PID_SERVIDOR)) == sizeof(none)) {
+        so_debug("Sessão reparada: registo %llu, SD %d", (unsigned long long) entry->index, pidServidorDedicado);
+        repair->repaired++;
+        inSession = FALSE;
+    }
+    lockRecordDB(repair->fd, entry->index, F_UNLCK);
+    return inSession;
+}
+
 /**
  * @brief S1     Ler a descrição da tarefa S1 no enunciado
  * @param nameDB O nome da base de dados (i.e., FILE_DATABASE)
  */
 void checkExistsDB_S1 (char *nameDB) {
     so_debug("< [@param nameDB:%s]", nameDB);  
-    if (access(nameDB, R_OK | W_OK | F_OK) == -1) {
-        so_error("S1",""); 
+
+    // --shards N: a BD está repartida pelos ficheiros nameDB.shard0..N-1 (ver bd_shard.h), e cada um é validado
+    // e aberto como uma BD completa. Sem --shards, há um só ficheiro: nameDB
+    BdHeader headers[BD_SHARDS_MAX];
+    uint64_t count = 0;
+    nShards = config.shards ? config.shards : 1;
+    for (int i = 0; i < nShards; i++) {
+        char name[PATH_MAX];
+        if (config.shards)
+            bdShardName(nameDB, i, name, sizeof(name));
+        else
+            snprintf(name, sizeof(name), "%s", nameDB);
+        if (!(shardNames[i] = strdup(name)) || access(name, R_OK | W_OK | F_OK) == -1) {
+            so_error("S1",""); 
+            exit(1);
+        }
+
+        // O cabeçalho da BD, se existir, diz qual o layout, se está ordenada e onde está o índice. Os acessos
+        // com stdio ou pread() só conhecem o vetor de CheckIn, pelo que uma BD colunar é sempre mapeada em memória.
+        // Um índice embutido é encontrado por bdIndexOpen(), e uma BD sem cabeçalho é lida como sempre foi
+        struct stat statDB;
+        int fd = open(name, O_RDONLY);
+        if (fd == -1 || fstat(fd, &statDB) == -1 || bdHeaderRead(fd, statDB.st_size, &headers[i]) == -1) {
+            so_error("S1", "BD %s inválida (cabeçalho, versão, tamanho dos registos ou checksum)", name);
+            exit(1);
+        }
+        close(fd);
+        if (headers[i].layout == BD_LAYOUT_COLUMNS)
+            config.io = BD_IO_MMAP;
+        count += headers[i].count;
+    }
+    dbHeader = headers[0];
+    // Os acessos com stdio só conhecem um ficheiro (dbHeader) e, com threads, o fclose() de uma libertaria os
+    // locks fcntl() de todas (são do processo)
+    if ((config.shards || config.threads) && config.io == BD_IO_STDIO)
+        config.io = BD_IO_PREAD;
+
+    // Com --io pread ou mmap, a BD fica aberta e os Servidores Dedicados herdam o descritor (e o mapeamento)
+    char description[128] = "";
+    for (int i = 0; config.io != BD_IO_STDIO && i < nShards; i++) {
+        if (!(config.io == BD_IO_MMAP ? bdMapOpen(shardNames[i], TRUE) : bdFdOpen(shardNames[i], TRUE))) {
+            so_error("S1", "Erro ao abrir %s", shardNames[i]);
+            exit(1);
+        }
+    }
+    if (config.shards)
+        snprintf(description, sizeof(description), "%d shards, %llu registos", nShards, (unsigned long long) count);
+    else if (dbHeader.magic == BD_MAGIC)
+        snprintf(description, sizeof(description), "v%u, %s, %llu registos%s%s", dbHeader.version,
+                 dbHeader.layout == BD_LAYOUT_COLUMNS ? "colunar" : "vetor", (unsigned long long) dbHeader.count,
+                 dbHeader.flags & BD_FLAG_SORTED ? ", ordenada" : "", dbHeader.indexOffset ? ", índice embutido" : "");
+
+    // --journal: as sessões que o diário deixou abertas (Servidores Dedicados mortos entre SD11 e SD13) são reparadas
+    if (config.journal) {
+        RepairContext repair = { .fd = open(nameDB, O_RDWR) };
+        long nOpen = repair.fd == -1 || bdJournalOpen(nameDB) != 0 ? -1 : bdJournalReplay(repair.fd, repairSessionDB, &repair);
+        if (repair.fd != -1)
+            close(repair.fd);
+        if (nOpen < 0) {
+            so_error("S1", "Erro no diário de %s", nameDB);
+            exit(1);
+        }
+        size_t length = strlen(description);
+        snprintf(description + length, sizeof(description) - length, "%sdiário: %ld sessões abertas, %ld reparadas",
+                 length ? ", " : "", nOpen, repair.repaired);
+    }
+
+    // --durability: no modo group, o flusher é criado agora, para que todos os Servidores Dedicados o partilhem
+    if (bdCommitStart(shardNames, nShards, config.durability) != 0) {
+        so_error("S1", "Erro ao preparar a durabilidade de %s", nameDB);
         exit(1);
     }
-    so_success("S1","");                       
+    if (bdCommitFlusher() > 0)
+        watchBackground(bdCommitFlusher());
+    // --sweep: cada ficheiro tem o seu sweeper, que o percorre ao seu ritmo (a sua parte de N), fora do CICLO1
+    for (int i = 0; config.sweepRate > 0 && i < nShards; i++)
+        startSweeper(shardNames[i], &headers[i], (config.sweepRate + nShards - 1) / nShards);
+    so_success("S1", "%s", description);                       
     so_debug(">");                             
 }
 /**
@@ -81,20 +450,73 @@ void checkExistsDB_S1 (char *nameDB) {
  */
 void createFifo_S2 (char *nameFifo) {
     so_debug("< [@param nameFifo:%s]", nameFifo); 
-    if (mkfifo(nameFifo, 0666) == -1) {
-        so_error("S2","");                        
-        exit(1);
-    }
-    if (access(nameFifo, F_OK) != -1) {
+    if (access(nameFifo, F_OK) != -1) {           // Remove o FIFO deixado por uma execução anterior
         if (unlink(nameFifo) == -1) {
             so_error("S2","");
             exit(1);
         }
     }
+    if (mkfifo(nameFifo, 0666) == -1) {
+        so_error("S2","");                        
+        exit(1);
+    }
+
+    // O FIFO fica aberto durante toda a vida do Servidor. A abertura não bloqueante não espera por um
+    // Cliente, e o escritor auxiliar garante que read() nunca devolve EOF quando não há Clientes ligados
+    requestFifo = open(nameFifo, O_RDONLY | O_NONBLOCK);
+    requestFifoWriter = open(nameFifo, O_WRONLY);
+    if (requestFifo == -1 || requestFifoWriter == -1 ||
+            fcntl(requestFifo, F_SETFL, fcntl(requestFifo, F_GETFL) & ~O_NONBLOCK) == -1) {
+        so_error("S2", "Erro ao abrir %s", nameFifo);
+        unlink(nameFifo);
+        exit(1);
+    }
+    if (config.ring && createRequestRing(requestFifo) == -1) {
+        so_error("S2", "Erro ao criar o anel de pedidos de %s", nameFifo);
+        unlink(nameFifo);
+        exit(1);
+    }
     so_success("S2","");                          
     so_debug(">");                               
 }
 
+/**
+ * @brief Liberta, num Servidor Dedicado acabado de criar, os recursos que só o Servidor usa
+ */
+void detachServidorDedicado () {
+    closeRequestFifo();    // Só o Servidor lê pedidos do FIFO
+    leaveEventLoop();
+    deferHandlers(SIG_UNBLOCK);
+    handlersDeferred = FALSE;
+}
+
+/**
+ * @brief No CICLO1, o SIGINT e o SIGCHLD ficam bloqueados (SIG_BLOCK) exceto durante a espera por pedidos em S4:
+ *        os handlers S6 e S8 escrevem com printf(), e um sinal entregue a meio de outro printf() do Servidor (e.g.,
+ *        S4 ou S5) pode bloqueá-lo para sempre no lock do stdout. Só tem efeito com handlersDeferred
+ * @param how SIG_BLOCK no CICLO1, SIG_UNBLOCK durante a espera em S4 e nos Servidores Dedicados
+ */
+static void deferHandlers (int how) {
+    sigset_t mask;
+    if (!handlersDeferred)
+        return;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(how, &mask, NULL);
+}
+
+/**
+ * @brief Fecha os descritores do FIFO do servidor. Chamada pelos Servidores Dedicados, que não lêem pedidos
+ */
+void closeRequestFifo () {
+    if (requestFifo != -1)
+        close(requestFifo);
+    if (requestFifoWriter != -1)
+        close(requestFifoWriter);
+    requestFifo = requestFifoWriter = -1;
+}
+
 /**
  * @brief S3   Ler a descrição da tarefa S3 no enunciado
  */
@@ -114,47 +536,143 @@ void triggerSignals_S3 () {
 
 
 /**
- * @brief S4       O CICLO1 já está a ser feito na função main(). Ler a descrição da tarefa S4 no enunciado
- * @param nameFifo O nome do FIFO do servidor (i.e., FILE_REQUESTS)
- * @return CheckIn Elemento com os dados preenchidos. Se nif=-1, significa que o elemento é inválido
+ * @brief Extrai o primeiro pedido completo de readBuffer (no formato binário, ou de texto com --text-protocol)
+ * @param request Onde colocar o pedido extraído (nif=-1 se for inválido)
+ * @return int    Nº de bytes consumidos de readBuffer, ou 0 se ainda não houver um pedido completo
  */
-CheckIn readRequest_S4(char *fifoName) {
-    CheckIn request;                             // Cria uma variável para armazenar o pedido
-    request.nif = -1;                            // Inicializa o campo NIF com -1, indicando invalidade
-    int fileDescriptor, numBytesRead;            // Variáveis para manipular o arquivo FIFO
-    char readBuffer[256];                        // Buffer para leitura dos dados do FIFO
+static int decodeRequest (const char *readBuffer, int length, CheckIn *request) {
+    request->nif = -1;
+    if (!config.textProtocol) {
+        RequestFrame frame;
+        if (length > 0 && readBuffer[0] == REQUEST_RING_DOORBELL)
+            return 1;                            // --ring: um Cliente acordou o Servidor; o pedido está no anel
+        if (length < (int) sizeof(RequestFrame))
+            return 0;
+        memcpy(&frame, readBuffer, sizeof(RequestFrame));
+        if (frame.magic != REQUEST_MAGIC)
+            return 1;                            // Dados corrompidos: avança um byte até reencontrar uma trama
+        requestFrameDecode(&frame, request);
+        return sizeof(RequestFrame);
+    }
 
-    fileDescriptor = open(fifoName, O_RDONLY);   // Abre o FIFO para leitura
-    if (fileDescriptor == -1) {                  // Verifica se a abertura falhou
-        so_error("S4", "", fifoName); 
-        deleteFifoAndExit_S7();                  // Chama a função para deletar o FIFO e sair
-        return request;                          // Retorna o pedido como inválido
+    // Protocolo de texto: cada pedido ocupa três linhas ("%d\n%s\n%d\n")
+    const char *end = readBuffer;
+    for (int lines = 0; lines < 3; lines++, end++) {
+        end = memchr(end, '\n', length - (end - readBuffer));
+        if (!end)
+            return 0;
     }
+    char line[REQUEST_TEXT_MAX];
+    int size = end - readBuffer < (int) sizeof(line) ? end - readBuffer : (int) sizeof(line) - 1;
+    memcpy(line, readBuffer, size);
+    line[size] = '\0';
+    if (sscanf(line, "%d %39s %d", &request->nif, request->senha, &request->pidCliente) != 3)
+        request->nif = -1;
+    return end - readBuffer;
+}
 
-    numBytesRead = read(fileDescriptor, readBuffer, sizeof(readBuffer) - 1); // Lê os dados do FIFO
-    if (numBytesRead <= 0) {                     // Verifica se a leitura falhou ou se não há dados
-        so_error("S4", "", fifoName); 
-        close(fileDescriptor);                   // Fecha o descriptor do arquivo
-        deleteFifoAndExit_S7();                  // Chama a função para deletar o FIFO e sair
-        return request;                          // Retorna o pedido como inválido
+/**
+ * @brief Extrai de buffer (com length bytes lidos do FIFO) até max pedidos completos, e guarda no início do buffer
+ *        o que sobrar: os pedidos completos para lá de max, e um pedido incompleto
+ * @return int Nº de pedidos válidos colocados em requests
+ */
+static int decodeBufferedRequests (char *buffer, int *length, CheckIn *requests, int max) {
+    int numRequests = 0, consumed = 0, n;
+
+    while (numRequests < max && (n = decodeRequest(buffer + consumed, *length - consumed, &requests[numRequests])) > 0) {
+        consumed += n;
+        if (n == 1 && !config.textProtocol)
+            continue;
+        CheckIn *request = &requests[numRequests];
+        if (request->nif > 0 && request->pidCliente > 0) { // Verifica se os dados extraídos são válidos
+            so_success("S4", "%d %s %d", request->nif, request->senha, request->pidCliente);
+            numRequests++;
+        } else {
+            so_error("S4", "Pedido inválido");
+        }
     }
+    memmove(buffer, buffer + consumed, *length - consumed);
+    *length -= consumed;
+    if (*length == REQUEST_BUFFER_SIZE && numRequests == 0) {
+        so_error("S4", "Dados inválidos no FIFO");
+        *length = 0;                             // Buffer cheio sem nenhum pedido completo: descarta-o
+    }
+    return numRequests;
+}
 
-    readBuffer[numBytesRead] = '\0';             // Assegura o término da string lida
-    sscanf(readBuffer, "%d %s %d", &request.nif, request.senha, &request.pidCliente); // Extrai dados do buffer
+/**
+ * @brief S4       Lê do FIFO do servidor todos os pedidos completos que já lá estejam (bloqueando até haver
+ *                 pelo menos um), para serem tratados em lote. O FIFO é aberto uma única vez, em S2, e um
+ *                 pedido que chegue incompleto fica guardado até à leitura seguinte. Uma leitura pode trazer
+ *                 mais de max pedidos: os que sobram são devolvidos na chamada seguinte, sem nova leitura.
+ *                 Com --ring, lê primeiro o anel, e só bloqueia no FIFO com o anel vazio
+ * @param nameFifo O nome do FIFO do servidor (i.e., FILE_REQUESTS)
+ * @param requests Onde colocar os pedidos lidos
+ * @param max      Nº máximo de pedidos a ler
+ * @return int     Nº de pedidos válidos colocados em requests
+ */
+int readRequestBatch_S4 (char *fifoName, CheckIn *requests, int max) {
+    static char readBuffer[REQUEST_BUFFER_SIZE];  // Bytes lidos do FIFO e ainda não consumidos
+    static int length = 0;
+    int numRequests, numBytesRead;
 
-    if (request.nif > 0 && request.pidCliente > 0) { // Verifica se os dados extraídos são válidos
-        so_success("S4", "%d %s %d", request.nif, request.senha, request.pidCliente); // Registra sucesso
-    } else {
-        so_error("S4", "", request.nif, request.pidCliente); 
-        close(fileDescriptor);                   // Fecha o descriptor do arquivo
-        deleteFifoAndExit_S7();                  // Chama a função para deletar o FIFO e sair
-        return request;                          // Retorna o pedido como inválido
+    while (TRUE) {
+        // Os pedidos completos que ficaram no buffer são tratados antes de uma nova leitura, que podia bloquear
+        if ((numRequests = decodeBufferedRequests(readBuffer, &length, requests, max)) > 0)
+            return numRequests;
+        int waitMs = -1;                         // Espera máxima no FIFO (-1 = até haver dados)
+        if (requestRingTurn()) {                 // --ring: os pedidos do anel não precisam de chamadas ao sistema
+            if ((numRequests = readRequestRing(requests, max)) > 0)
+                return numRequests;
+            if ((waitMs = sleepRequestRing()) == 0) {
+                wakeRequestRing();               // Chegou um pedido ao anel entre a leitura e a marca de parado
+                continue;
+            }
+        }
+        deferHandlers(SIG_UNBLOCK);              // S6 e S8 podem correr durante a espera
+        // Com --event-loop, o S4 nunca espera por um Cliente atrasado: é o epoll_wait() que volta quando a posição
+        // pode ser saltada (ver requestRingStallMs())
+        if (waitMs > 0 && !config.eventLoop && poll(&(struct pollfd) { .fd = requestFifo, .events = POLLIN }, 1, waitMs) != 1) {
+            deferHandlers(SIG_BLOCK);            // Um Cliente do anel está atrasado: volta a ver a sua posição
+            if (shutdownPending)
+                trataSinalSIGINT_S6(SIGINT);     // Nunca regressa
+            wakeRequestRing();
+            continue;
+        }
+        numBytesRead = read(requestFifo, readBuffer + length, sizeof(readBuffer) - length); // Bloqueia até haver dados
+        deferHandlers(SIG_BLOCK);
+        if (shutdownPending)
+            trataSinalSIGINT_S6(SIGINT);         // --threads: S6 fora do handler, agora que S4 acordou; nunca regressa
+        if (numBytesRead > 0)
+            wakeRequestRing();                   // Com --event-loop e o FIFO vazio (EAGAIN), o Servidor continua parado
+        if (numBytesRead == -1 && errno == EINTR)
+            continue;
+        if (numBytesRead == -1 && errno == EAGAIN)
+            return 0;                            // --event-loop: FIFO vazio, e nenhum pedido completo no buffer
+        if (numBytesRead <= 0) {                 // Com o escritor auxiliar aberto, nunca há EOF
+            so_error("S4", "", fifoName);
+            deleteFifoAndExit_S7();              // Chama a função para deletar o FIFO e sair
+        }
+        length += numBytesRead;
     }
-
-    close(fileDescriptor);                       // Fecha o descriptor do arquivo após a leitura bem-sucedida
-    return request;                              // Retorna o pedido extraído
 }
 
+/**
+ * @brief S4       O CICLO1 já está a ser feito na função main(). Ler a descrição da tarefa S4 no enunciado
+ *                 Devolve o pedido seguinte do lote lido por readRequestBatch_S4()
+ * @param nameFifo O nome do FIFO do servidor (i.e., FILE_REQUESTS)
+ * @return CheckIn Elemento com os dados preenchidos. Se nif=-1, significa que o elemento é inválido
+ */
+CheckIn readRequest_S4(char *fifoName) {
+    static CheckIn requests[REQUEST_BATCH_MAX];
+    static int next = 0, numRequests = 0;
+
+    if (next == numRequests) {
+        numRequests = readRequestBatch_S4(fifoName, requests, REQUEST_BATCH_MAX);
+        next = 0;
+    }
+    return requests[next++];
+}
 
 /**
  * @brief S5   Ler a descrição da tarefa S5 no enunciado
@@ -167,7 +685,7 @@ int createServidorDedicado_S5() {
 
     so_debug("<");       
 
-    forkResult = fork(); // Cria um novo processo (filho)
+    forkResult = forkServidorDedicado(); // Cria um novo processo (filho), registado em liveServidores
     if (forkResult == -1) { // Verifica se o fork falhou
         so_error("S5", "ERRO NO FORK"); // Registra um erro se o fork falhar
         deleteFifoAndExit_S7();         // Chama a função para deletar o FIFO e sair
@@ -185,6 +703,134 @@ int createServidorDedicado_S5() {
     return childPid;                      // Retorna o PID do processo filho ou 0 se for o filho
 }
 
+/**
+ * @brief Cria um Servidor Dedicado com fork() e regista o seu PID em liveServidores. SIGCHLD e SIGINT ficam
+ *        bloqueados até o PID estar no conjunto, para que S8 e S6 nunca o encontrem a meio de uma alteração
+ * @return pid_t O resultado de fork()
+ */
+pid_t forkServidorDedicado () {
+    sigset_t mask, previous;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &previous);
+
+    fflush(stdout);      // Evita que o filho herde (e volte a escrever) o que ainda está no buffer
+    pid_t pid = fork();
+    if (pid > 0 && pidSetAdd(&liveServidores, pid) == -1)
+        so_error("S5", "Sem memória para registar o SD %d", pid);
+    sigprocmask(SIG_SETMASK, &previous, NULL);
+    return pid;
+}
+
+/**
+ * @brief Regista o fim de um Servidor Dedicado, já recolhido com wait() (S8)
+ * @param pid O PID do Servidor Dedicado que terminou
+ */
+void reapServidorDedicado (int pid) {
+    pidSetRemove(&liveServidores, pid);
+    reapPool(pid);       // Se era do pool, será substituído
+}
+
+/**
+ * @brief S6 TRUE se o Servidor Dedicado de uma sessão na BD deve receber o SIGUSR2: não é um dos que o Servidor conhece
+ *        (esses já o receberam) nem um PID reutilizado por outro programa. Um PID que já não existe conta, como no
+ *        enunciado: o kill() não tem efeito
+ */
+static int shutdownTarget (int pidServidorDedicado) {
+    char path[32];
+    if (pidServidorDedicado <= 0 || pidSetContains(&liveServidores, pidServidorDedicado))
+        return FALSE;
+    snprintf(path, sizeof(path), "/proc/%d", pidServidorDedicado);
+    return access(path, F_OK) == -1 || servidorDedicadoAlive(pidServidorDedicado);
+}
+
+/**
+ * @brief S6 TRUE se a BD aberta em S1 ainda é o ficheiro FILE_DATABASE. Se entretanto tiver sido substituída (e.g., por
+ *        uma ferramenta que escreve um ficheiro novo e o renomeia) ou removida, S6 lê-a pelo nome
+ */
+static int sameFileDB (Bd *bd) {
+    struct stat opened, named;
+    return fstat(bd->fd, &opened) == 0 && stat(FILE_DATABASE, &named) == 0 &&
+           opened.st_dev == named.st_dev && opened.st_ino == named.st_ino;
+}
+
+/**
+ * @brief S6 Mostra as estatísticas do Servidor, depois de todos os Servidores Dedicados terem recebido o SIGUSR2, e
+ *        termina em S7
+ */
+static void shutdownExit_S6 () {
+    so_success("S6", "Servidor: %ld check-ins, %ld esperas por locks de registos, %ld check-ins sobre sessões abertas, %ld sessões mantidas",
+               atomic_load(&stats->checkins), atomic_load(&stats->lockContention),
+               atomic_load(&stats->sessionCollisions), atomic_load(&stats->sessionsKept));
+    requestRingStats();               // --ring: pedidos recebidos pelo anel e pelo FIFO
+    if (config.sweepRate > 0)
+        so_success("S6", "Servidor: sweeper com %ld passagens, %ld registos verificados, %ld sessões abandonadas limpas",
+                   atomic_load(&stats->sweepPasses), atomic_load(&stats->sweptRecords), atomic_load(&stats->sessionsSwept));
+    long journalEntries, journalCommits, journalSyncs;
+    bdJournalStats(&journalEntries, &journalCommits, &journalSyncs);
+    if (journalEntries >= 0)   // --journal: cada fdatasync() cobre em média commits / syncs check-ins
+        so_success("S6", "Servidor: diário com %ld entradas, %ld commits, %ld fdatasync()", journalEntries, journalCommits, journalSyncs);
+    BdCommitStats commitStats;
+    if (bdCommitStats(&commitStats) == 0) {   // --durability record|group: latência da escrita do registo até estar em disco
+        char mode[32];
+        bdDurabilityFormat(&config.durability, mode, sizeof(mode));
+        so_success("S6", "Servidor: durabilidade %s, %ld commits, %ld fdatasync(), latência média %.3f ms, p50 %.3f ms, p99 %.3f ms, máx %.3f ms",
+                   mode, commitStats.commits, commitStats.syncs, commitStats.meanMs, commitStats.p50Ms, commitStats.p99Ms, commitStats.maxMs);
+    }
+    deleteFifoAndExit_S7();
+}
+
+/**
+ * @brief S6 Envia SIGUSR2 aos Servidores Dedicados com sessões na BD bd que o Servidor não conhece
+ */
+static void scanSessionsDB (Bd *bd) {
+    static CheckIn chunk[BD_READ_CHUNK];
+    lockRecordDB(bd->fd, -1, F_RDLCK);            // Nenhum Servidor Dedicado altera registos durante a leitura
+    for (size_t i = 0; i < bd->count; i++) {
+        if (!bd->map && i % BD_READ_CHUNK == 0 && bdReadRange(bd, i, chunk, BD_READ_CHUNK) <= 0) {
+            so_error("S6.2", "");
+            break;
+        }
+        int pidServidorDedicado = bd->map ? bdGetPidServidor(bd, i) : chunk[i % BD_READ_CHUNK].pidServidorDedicado;
+        if (shutdownTarget(pidServidorDedicado)) {
+            kill(pidServidorDedicado, SIGUSR2); // Envia sinal SIGUSR2 para cada Servidor Dedicado
+            so_success("S6.3", "Servidor: Shutdown SD %d", pidServidorDedicado);
+        }
+    }
+    lockRecordDB(bd->fd, -1, F_UNLCK);
+}
+
+/**
+ * @brief S6 Percorre os ficheiros da BD; com --shards, cada um num processo filho, em paralelo.
+ *        O SIGCHLD fica bloqueado até todos terminarem, para que S8 não os confunda com Servidores Dedicados
+ */
+static void scanShardsDB () {
+    pid_t scanners[BD_SHARDS_MAX];
+    sigset_t mask, previous;
+
+    if (nShards == 1) {
+        scanSessionsDB(bdFind(shardNames[0]));
+        return;
+    }
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &previous);
+    fflush(stdout);
+    for (int i = 0; i < nShards; i++) {
+        if ((scanners[i] = fork()) == 0) {
+            scanSessionsDB(bdFind(shardNames[i]));
+            exit(0);
+        }
+        if (scanners[i] == -1)                    // Sem mais processos: este ficheiro é percorrido pelo Servidor
+            scanSessionsDB(bdFind(shardNames[i]));
+    }
+    for (int i = 0; i < nShards; i++)
+        if (scanners[i] > 0)
+            while (waitpid(scanners[i], NULL, 0) == -1 && errno == EINTR);
+    sigprocmask(SIG_SETMASK, &previous, NULL);
+}
+
 /**
  * @brief S6            Ler a descrição das tarefas S6 e S7 no enunciado
  * @param sinalRecebido nº do Sinal Recebido (preenchido pelo SO)
@@ -192,30 +838,74 @@ int createServidorDedicado_S5() {
 void trataSinalSIGINT_S6(int signalReceived) {
     so_debug("< [@param signalReceived:%d]", signalReceived); 
 
+    // --threads no CICLO1: stopThreads() usa pthread_cancel() e pthread_join(), que não podem ser chamadas num
+    // handler. O handler só acorda S4, com um byte no FIFO (o dos Clientes do anel), e S4 volta a chamar S6
+    if (handlersDeferred && config.threads > 0 && !shutdownPending) {
+        char doorbell = REQUEST_RING_DOORBELL;
+        shutdownPending = TRUE;
+        if (write(requestFifoWriter, &doorbell, 1) == 1)
+            return;
+    }
+
     FILE *databaseFile;               // Variável para o arquivo da base de dados
     CheckIn checkInData;              // Variável para armazenar dados lidos do arquivo
-
+    BdHeader header;                  // Cabeçalho do ficheiro lido por S6.1, que pode já não ser o validado em S1
+    struct stat fileStat;
+    sigset_t mask;
+    Bd *bd = bdFind(shardNames[0]);   // BD aberta no passo S1 (--io pread ou mmap), ou NULL
+
+    // Os SDs que terminam com o SIGUSR2 só são recolhidos (S8) depois de S6: liveServidores não muda a meio
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
     so_success("S6", "Servidor: Start Shutdown"); // Mensagem indicando início do desligamento
+    stopThreads();                    // --threads: o cancelamento substitui o SIGUSR2, e as estatísticas ficam completas
+
+    // Os Servidores Dedicados vivos são conhecidos sem ler a BD (incluindo os do pool, que lá não constam)
+    for (size_t i = 0; i < liveServidores.nSlots; i++) {
+        if (liveServidores.slots[i] > 0) {
+            kill(liveServidores.slots[i], SIGUSR2); // Envia sinal SIGUSR2 para cada Servidor Dedicado
+            so_success("S6.3", "Servidor: Shutdown SD %d", liveServidores.slots[i]);
+        }
+    }
+    if (config.quickShutdown)
+        shutdownExit_S6();
+
+    // A BD é percorrida à procura das sessões de Servidores Dedicados que o Servidor não conhece
+    if (bd && (config.shards || sameFileDB(bd))) {                                     // Percorre os registos mapeados, ou lidos em blocos com pread()
+        so_success("S6.1", "");
+        scanShardsDB();
+        so_success("S6.2", "");
+        shutdownExit_S6();
+    }
 
     databaseFile = fopen(FILE_DATABASE, "rb");    // Abre o arquivo da base de dados para leitura
     if (databaseFile == NULL) {                   // Verifica se a abertura falhou
         so_error("S6.1", "", FILE_DATABASE); 
-        deleteFifoAndExit_S7();                   // Deleta o FIFO e sai
+        shutdownExit_S6();                        // Deleta o FIFO e sai
     }
     so_success("S6.1", "");                       // Registra sucesso na abertura do arquivo
+    lockRecordDB(fileno(databaseFile), -1, F_RDLCK); // Libertado no fclose()
+    if (fstat(fileno(databaseFile), &fileStat) == -1 || bdHeaderRead(fileno(databaseFile), fileStat.st_size, &header) != 0 ||
+            header.layout != BD_LAYOUT_ROWS) {    // As colunas só são lidas através da BD aberta em S1
+        so_error("S6.2", "", FILE_DATABASE);
+        fclose(databaseFile);
+        shutdownExit_S6();
+    }
+    fseeko(databaseFile, bdRecordOffset(&header, 0), SEEK_SET);
 
-    while (1) {
+    for (uint64_t i = 0; i < header.count; i++) { // Um índice embutido, a seguir aos registos, não é lido
         ssize_t bytesRead = fread(&checkInData, sizeof(CheckIn), 1, databaseFile); // Lê dados do arquivo
         if (bytesRead < 0) {
             so_error("S6.2", "", FILE_DATABASE); 
             fclose(databaseFile);                   // Fecha o arquivo
-            deleteFifoAndExit_S7();                 // Deleta o FIFO e sai
+            shutdownExit_S6();                      // Deleta o FIFO e sai
         }
         if (bytesRead == 0) {
             break;  // Sai do loop se não houver mais dados para ler
         }
 
-        if (checkInData.pidServidorDedicado > 0) {
+        if (shutdownTarget(checkInData.pidServidorDedicado)) {
             kill(checkInData.pidServidorDedicado, SIGUSR2); // Envia sinal SIGUSR2 para cada Servidor Dedicado
             so_success("S6.3", "Servidor: Shutdown SD %d", checkInData.pidServidorDedicado); // Registra sucesso no envio do sinal
         }
@@ -223,7 +913,7 @@ void trataSinalSIGINT_S6(int signalReceived) {
 
     so_success("S6.2", ""); 
     fclose(databaseFile);                         // Fecha o arquivo
-    deleteFifoAndExit_S7();                       // Deleta o FIFO e sai
+    shutdownExit_S6();                            // Deleta o FIFO e sai
     so_debug(">");                                // Mensagem de debug para indicar fim da função
 }
 
@@ -234,6 +924,8 @@ void trataSinalSIGINT_S6(int signalReceived) {
 void deleteFifoAndExit_S7() {
     so_debug("<");  
 
+    closeRequestFifo();
+    deleteRequestRing();              // --ring: os Clientes que ainda o tenham mapeado deixam de o usar
     if (unlink(FILE_REQUESTS) != -1) { // Tenta remover o FIFO
         so_success("S7", "Servidor: End Shutdown"); // Registra sucesso no término do desligamento
     } else {
@@ -252,13 +944,15 @@ void trataSinalSIGCHLD_S8(int signalReceived) {
     so_debug("< [@param signalReceived:%d]", signalReceived); 
 
     int pid, status; // Variáveis para PID do processo e status de terminação
-    pid = wait(&status); // Espera por mudanças de estado em qualquer processo filho
 
-    if (pid > 0) { // Se um PID válido for retornado
+    // Vários SIGCHLD simultâneos são entregues como um só: recolhe todos os filhos que já terminaram. Nunca
+    // bloqueia: o filho deste SIGCHLD pode já ter sido recolhido no anterior, e os SDs do pool não terminam
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
         so_success("S8", "Servidor: Confirmo fim de SD %d", pid); // Confirma o término de um processo filho
-    } else {
-        so_error("S8", ""); // Registra erro se falhar ao esperar
+        reapServidorDedicado(pid);
     }
+    if (pid == -1 && errno != ECHILD && errno != EINTR)
+        so_error("S8", ""); // Registra erro se falhar ao esperar
 
     so_debug(">");
 }
@@ -270,6 +964,11 @@ void trataSinalSIGCHLD_S8(int signalReceived) {
 void triggerSignals_SD9() {
     so_debug("<"); 
 
+    if (inThread()) {   // --threads: os sinais são do processo; a thread já bloqueia o SIGINT, e o SIGUSR2 dá lugar ao cancelamento
+        so_success("SD9", "SINAIS ARMADOS: %d (thread)", servidorDedicadoId());
+        return;
+    }
+
     if (signal(SIGINT, SIG_IGN) == SIG_ERR) { // Ignora o sinal SIGINT
         so_error("SD9", ""); // Registra erro se falhar
     }
@@ -284,6 +983,30 @@ void triggerSignals_SD9() {
 }
 
 
+/**
+ * @brief Lê o registo indexClient da BD aberta no passo S1 (se bd != NULL: mapeamento ou pread()) ou do ficheiro dbFile
+ * @return int 0 em caso de sucesso, -1 se o registo não existir
+ */
+static int readRecordDB (Bd *bd, FILE *dbFile, int indexClient, CheckIn *record) {
+    if (bd)
+        return indexClient < 0 ? -1 : bdRead(bd, indexClient, record);
+    if ((uint64_t) indexClient >= dbHeader.count || fseeko(dbFile, bdRecordOffset(&dbHeader, indexClient), SEEK_SET) != 0 ||
+            fread(record, sizeof(CheckIn), 1, dbFile) != 1)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Lê o nif do registo i diretamente do ficheiro da BD aberto em *context (para bdInterpolationSearch())
+ * @return int32_t O NIF, ou -1 em caso de erro
+ */
+static int32_t readNifDB (void *context, uint64_t i) {
+    int32_t nif;
+    if (pread(*(int *) context, &nif, sizeof(nif), bdRecordOffset(&dbHeader, i) + offsetof(CheckIn, nif)) != sizeof(nif))
+        return -1;
+    return nif;
+}
+
 /**
  * @brief SD10    Ler a descrição da tarefa SD10 no enunciado
  * @param request O pedido do cliente
@@ -292,38 +1015,109 @@ void triggerSignals_SD9() {
  * @return int    Em caso de sucesso, retorna o índice de itemDB no ficheiro nameDB.
  */
 int searchClientDB_SD10(CheckIn clientRequest, char *nameDB, CheckIn *itemDB) {
-    FILE *dbFile = fopen(nameDB, "rb"); // Abre a base de dados para leitura binária
-    if (!dbFile) {
+    Bd *bd = bdFind(nameDB);            // BD aberta no passo S1 (--io pread ou mmap), ou NULL
+    FILE *dbFile = NULL;
+    if (!bd && !(dbFile = fopen(nameDB, "rb"))) { // Abre a base de dados para leitura binária
         so_error("SD10.1", "Erro ao abrir o arquivo: %s", nameDB); // Registra erro se falhar
-        kill(clientRequest.pidCliente, SIGHUP); // Envia sinal de erro ao cliente
-        exit(1); // Termina o servidor dedicado
+        sendReply(&clientRequest, REPLY_ERROR); // Envia o erro ao cliente
+        exitServidorDedicado(1); // Termina o servidor dedicado
     }
 
-    int indexClient = 0; // Inicia o índice em 0 para uso no loop
+    int indexClient = -1;
     CheckIn checkInData;
-
-    while (fread(&checkInData, sizeof(CheckIn), 1, dbFile)) {
-        if (checkInData.nif == clientRequest.nif) {
-            if (strcmp(checkInData.senha, clientRequest.senha) == 0) {
-                fclose(dbFile);
-                *itemDB = checkInData;  // Copia os dados lidos para itemDB
-                so_success("SD10.3", "%d", indexClient);
-                return indexClient;  // Sucesso, retorna o índice encontrado
-            } else {
-                so_error("SD10.3", "Cliente %d: Senha errada", clientRequest.nif);
-                fclose(dbFile);
-                kill(clientRequest.pidCliente, SIGHUP);  // Senha incorreta, sinal ao cliente
-                exit(1);
+    BdIndex index = { .fd = -1 };
+    if (!bd)                            // Com a BD aberta no passo S1, o índice também já foi aberto
+        bdIndexOpen(&index, nameDB, FALSE);
+    BdIndex *bdIndex = bd ? &bd->index : &index;
+
+    if (bdIndex->fd != -1) {            // Se houver índice, a pesquisa é O(1)
+        indexClient = bdIndexLookup(bdIndex, clientRequest.nif);
+        if (indexClient >= 0 && (readRecordDB(bd, dbFile, indexClient, &checkInData) != 0 ||
+                checkInData.nif != clientRequest.nif))
+            indexClient = -1; // Índice desatualizado: recorre à pesquisa sequencial
+    }
+    bdIndexClose(&index);
+    indexSyncPending = (indexClient < 0); // SD11 acrescenta ao índice o NIF que não estava lá
+
+    if (indexClient < 0 && bd) {
+        // Por interpolação, se a BD estiver ordenada; sem mapeamento, com pread() no descritor herdado
+        indexClient = bdSearchNif(bd, clientRequest.nif, &checkInData);
+    } else if (indexClient < 0 && (dbHeader.flags & BD_FLAG_SORTED)) {
+        // BD ordenada: pesquisa por interpolação, com um pread() do nif por passo
+        int fd = fileno(dbFile);
+        indexClient = bdInterpolationSearch(dbHeader.sortedCount, clientRequest.nif, readNifDB, &fd);
+        if (indexClient >= 0 && readRecordDB(NULL, dbFile, indexClient, &checkInData) != 0)
+            indexClient = -1;
+    }
+    if (indexClient < 0 && !bd) {        // Pesquisa sequencial (numa BD ordenada, só dos registos acrescentados depois)
+        static CheckIn chunk[SCAN_CHUNK_RECORDS]; // Lidos em blocos, para a pesquisa vetorizada (ver bd_scan.h)
+        size_t n, first = dbHeader.flags & BD_FLAG_SORTED ? dbHeader.sortedCount : 0;
+        long found = -1;
+        fseeko(dbFile, bdRecordOffset(&dbHeader, first), SEEK_SET);
+        while (found < 0 && first < dbHeader.count && (n = fread(chunk, sizeof(CheckIn), SCAN_CHUNK_RECORDS, dbFile)) > 0) {
+            if (n > dbHeader.count - first)
+                n = dbHeader.count - first;   // Não lê um índice embutido
+            found = bdScanNifKernel(&chunk[0].nif, n, sizeof(CheckIn) / sizeof(int32_t), clientRequest.nif, BD_SCAN_AUTO);
+            if (found >= 0) {
+                checkInData = chunk[found];
+                indexClient = first + found;
             }
+            first += n;
         }
-        indexClient++;
+    }
+    if (dbFile)
+        fclose(dbFile);
+    if (indexClient < 0) {
+        so_error("SD10.1", "Cliente %d: não encontrado", clientRequest.nif); // Registra erro se cliente não for encontrado
+        sendReply(&clientRequest, REPLY_NOT_FOUND); // Envia o erro ao cliente
+        exitServidorDedicado(1); // Termina o servidor dedicado
     }
 
-    so_error("SD10.1", "Cliente %d: não encontrado", clientRequest.nif); // Registra erro se cliente não for encontrado
-    fclose(dbFile); // Fecha o arquivo
-    kill(clientRequest.pidCliente, SIGHUP); // Envia sinal de erro ao cliente
-    exit(1); // Termina o servidor dedicado
-    return -1;
+    if (strcmp(checkInData.senha, clientRequest.senha) != 0) {
+        so_error("SD10.3", "Cliente %d: Senha errada", clientRequest.nif);
+        sendReply(&clientRequest, REPLY_WRONG_PASSWORD); // Senha incorreta, erro ao cliente
+        exitServidorDedicado(1);
+    }
+
+    *itemDB = checkInData;  // Copia os dados lidos para itemDB
+    so_success("SD10.3", "%d", indexClient);
+    return indexClient;  // Sucesso, retorna o índice encontrado
+}
+
+/**
+ * @brief --journal: regista no diário o fim da sessão deste Servidor Dedicado no registo indexClient. Só é escrito
+ *        depois de o registo ter sido limpo, e não espera pelo fdatasync(): se a entrada se perder, o passo S1
+ *        encontra o registo já limpo (ou limpa-o)
+ */
+static void journalCloseSession (int nif, int indexClient) {
+    if (bdJournalAppend(BD_JOURNAL_CLOSE, indexClient, nif, -1, servidorDedicadoId()) != 0)
+        so_error("SD13.3", "Erro ao escrever no diário");
+}
+
+/**
+ * @brief SD11 Desfaz o check-in que falhou depois de escrever o registo (e.g., --durability sem fdatasync()): os PIDs
+ *        do registo voltam a -1, se ainda forem deste Servidor Dedicado, e a sessão é fechada no diário. Sem bd, o
+ *        registo é reescrito em fileDB, que ainda tem o lock
+ */
+static void abortCheckinDB (Bd *bd, FILE *fileDB, int nif, int indexClient) {
+    int pidServidorDedicado = -1;
+    if (bd) {
+        if (lockRecordDB(bd->fd, indexClient, F_WRLCK) == 0 && bdReadPidServidor(bd, indexClient, &pidServidorDedicado) == 0 &&
+                pidServidorDedicado == servidorDedicadoId())
+            bdWritePids(bd, indexClient, -1, -1);
+        lockRecordDB(bd->fd, indexClient, F_UNLCK);
+    } else {
+        CheckIn record;
+        long fileOffset = bdRecordOffset(&dbHeader, indexClient);
+        clearerr(fileDB);
+        if (fseek(fileDB, fileOffset, SEEK_SET) == 0 && fread(&record, sizeof(CheckIn), 1, fileDB) == 1 &&
+                record.pidServidorDedicado == servidorDedicadoId() && fseek(fileDB, fileOffset, SEEK_SET) == 0) {
+            record.pidCliente = record.pidServidorDedicado = -1;
+            if (fwrite(&record, sizeof(CheckIn), 1, fileDB) == 1)
+                fflush(fileDB);
+        }
+    }
+    journalCloseSession(nif, indexClient);
 }
 
 /**
@@ -339,34 +1133,127 @@ void checkinClientDB_SD11(CheckIn *clientData, char *databaseName, int clientInd
 
     strcpy(clientData->nome, databaseRecord.nome); // Copia o nome do registro da BD para o cliente
     strcpy(clientData->nrVoo, databaseRecord.nrVoo); // Copia o número do voo do registro da BD para o cliente
-    clientData->pidServidorDedicado = getpid(); // Atualiza o PID do servidor dedicado
+    clientData->pidServidorDedicado = servidorDedicadoId(); // Atualiza o PID do servidor dedicado (o TID, numa thread)
     so_success("SD11.1", "%s %s %d", clientData->nome, clientData->nrVoo, clientData->pidServidorDedicado); // Registra sucesso
 
+    // --journal: o check-in fica no diário, em disco, antes de o registo ser escrito (write-ahead)
+    if (bdJournalAppend(BD_JOURNAL_CHECKIN, clientIndex, clientData->nif, clientData->pidCliente, clientData->pidServidorDedicado) != 0 ||
+            bdJournalCommit() != 0) {
+        so_error("SD11.3", "Erro ao escrever no diário");
+        sendReply(clientData, REPLY_ERROR);
+        exitServidorDedicado(1);
+    }
+
+    Bd *bd = bdFind(databaseName);
+    if (bd) {   // BD aberta no passo S1: o registo é atualizado na memória partilhada (mmap) ou com um pwrite()
+        int pidServidorDedicado;
+        if (lockRecordDB(bd->fd, clientIndex, F_WRLCK) != 0 || bdReadPidServidor(bd, clientIndex, &pidServidorDedicado) != 0) {
+            so_error("SD11.3", "");
+            lockRecordDB(bd->fd, clientIndex, F_UNLCK);
+            sendReply(clientData, REPLY_ERROR);
+            exitServidorDedicado(1);
+        }
+        if (pidServidorDedicado > 0)
+            atomic_fetch_add(&stats->sessionCollisions, 1);
+        int written = bdWrite(bd, clientIndex, clientData);
+        lockRecordDB(bd->fd, clientIndex, F_UNLCK);
+        if (written != 0 || bdCommitWait(databaseName) != 0) {  // --durability: espera que o registo esteja em disco
+            so_error("SD11.4", "");
+            sendReply(clientData, REPLY_ERROR);
+            abortCheckinDB(bd, NULL, clientData->nif, clientIndex);
+            exitServidorDedicado(1);
+        }
+        atomic_fetch_add(&stats->checkins, 1);
+        so_success("SD11.4", "Dados escritos com sucesso");
+        syncIndexDB(bd, databaseName, clientData->nif, clientIndex);
+        return;
+    }
+
     databaseFile = fopen(databaseName, "r+"); // Abre a base de dados para leitura e escrita
     if (databaseFile == NULL) {
         so_error("SD11.2", "", databaseName); // Registra erro se falhar
-        kill(clientData->pidCliente, SIGHUP); // Envia sinal de erro ao cliente
-        exit(1); // Encerra após erro
+        sendReply(clientData, REPLY_ERROR); // Envia o erro ao cliente
+        exitServidorDedicado(1); // Encerra após erro
     }
 
-    fileOffset = clientIndex * sizeof(CheckIn); // Calcula o deslocamento para o registro do cliente
-    if (fseek(databaseFile, fileOffset, SEEK_SET) != 0) {
+    // O registo fica bloqueado (fcntl) até ao fclose(), para que outro Servidor Dedicado não o escreva ao mesmo tempo
+    fileOffset = bdRecordOffset(&dbHeader, clientIndex); // Calcula o deslocamento para o registro do cliente
+    CheckIn currentRecord;
+    if (lockRecordDB(fileno(databaseFile), clientIndex, F_WRLCK) != 0 || fseek(databaseFile, fileOffset, SEEK_SET) != 0 ||
+            fread(&currentRecord, sizeof(CheckIn), 1, databaseFile) != 1 || fseek(databaseFile, fileOffset, SEEK_SET) != 0) {
         so_error("SD11.3", "", databaseName); // Registra erro se falhar
         fclose(databaseFile); // Fecha o arquivo
-        kill(clientData->pidCliente, SIGHUP); // Envia sinal de erro ao cliente
-        exit(1); // Encerra após erro
+        sendReply(clientData, REPLY_ERROR); // Envia o erro ao cliente
+        exitServidorDedicado(1); // Encerra após erro
     }
 
-    if (fwrite(clientData, sizeof(CheckIn), 1, databaseFile) == 1) {
+    if (currentRecord.pidServidorDedicado > 0)
+        atomic_fetch_add(&stats->sessionCollisions, 1);
+
+    if (fwrite(clientData, sizeof(CheckIn), 1, databaseFile) == 1 && fflush(databaseFile) == 0 && bdCommitWait(databaseName) == 0) {
+        atomic_fetch_add(&stats->checkins, 1);
         so_success("SD11.4", "Dados escritos com sucesso"); // Registra sucesso na escrita dos dados
     } else {
         so_error("SD11.4", "", databaseName); // Registra erro na escrita
-        fclose(databaseFile); // Fecha o arquivo
-        kill(clientData->pidCliente, SIGHUP); // Envia sinal de erro ao cliente
-        return; // Encerra após erro
+        sendReply(clientData, REPLY_ERROR); // Envia o erro ao cliente
+        abortCheckinDB(NULL, databaseFile, clientData->nif, clientIndex);
+        fclose(databaseFile); // Fecha o arquivo (e liberta o lock)
+        exitServidorDedicado(1); // Encerra após erro
+    }
+
+    fclose(databaseFile); // Fecha o arquivo após a operação bem-sucedida (o fclose() liberta o lock)
+    syncIndexDB(NULL, databaseName, clientData->nif, clientIndex);
+}
+
+/**
+ * @brief Bloqueia (fcntl) o registo indexClient da BD aberta em fd, esperando se outro processo o tiver bloqueado
+ * @param fd          O descritor da base de dados
+ * @param indexClient O índice do registo, ou -1 para toda a BD
+ * @param type        F_RDLCK, F_WRLCK ou F_UNLCK
+ * @return int        0 em caso de sucesso, -1 em caso de erro
+ */
+int lockRecordDB (int fd, int indexClient, short type) {
+    struct flock lock = {
+        .l_type = type, .l_whence = SEEK_SET,
+        .l_start = indexClient < 0 ? 0 : (off_t) indexClient * sizeof(CheckIn),
+        .l_len = indexClient < 0 ? 0 : sizeof(CheckIn)       // 0 = até ao fim do ficheiro
+    };
+    if (type == F_UNLCK) {
+        int result = fcntl(fd, F_SETLK, &lock);
+        lockRecordThreads(indexClient, F_UNLCK);
+        return result;
     }
+    lockRecordThreads(indexClient, type);                      // --threads: primeiro entre as threads do processo
+    if (fcntl(fd, F_SETLK, &lock) == 0)
+        return 0;
+    if (errno == EACCES || errno == EAGAIN) {
+        int result;
+        atomic_fetch_add(&stats->lockContention, 1);            // Colisão com outro processo: espera pelo lock
+        while ((result = fcntl(fd, F_SETLKW, &lock)) == -1 && errno == EINTR);
+        if (result == 0)
+            return 0;
+    }
+    lockRecordThreads(indexClient, F_UNLCK);
+    return -1;
+}
 
-    fclose(databaseFile); // Fecha o arquivo após a operação bem-sucedida
+/**
+ * @brief Acrescenta ao índice da BD o cliente que SD10 só encontrou pela pesquisa sequencial
+ * @param bd          BD aberta no passo S1 (--io pread ou mmap), cujo índice já está aberto, ou NULL
+ * @param nameDB      O nome da base de dados
+ * @param nif         O NIF do cliente
+ * @param indexClient O índice na base de dados do elemento correspondente ao cliente
+ */
+static void syncIndexDB (Bd *bd, char *nameDB, int nif, int indexClient) {
+    BdIndex index = { .fd = -1 };
+    if (!indexSyncPending || (!bd && bdIndexOpen(&index, nameDB, TRUE) != 0))
+        return;
+    BdIndex *bdIndex = bd ? &bd->index : &index;
+    lockIndexThreads(F_WRLCK);    // --threads: o lock fcntl() do índice não exclui as outras threads, que partilham bd->index
+    if (bdIndex->fd != -1 && bdIndexInsert(bdIndex, nif, indexClient) == 0)
+        so_success("SD11.5", "Índice atualizado: %d -> %d", nif, indexClient);
+    lockIndexThreads(F_UNLCK);
+    bdIndexClose(&index);
 }
 
 
@@ -376,19 +1263,61 @@ void checkinClientDB_SD11(CheckIn *clientData, char *databaseName, int clientInd
  * @param pidCliente PID (Process ID) do processo Cliente
  */
 void sendAckCheckIn_SD12 (int pidCliente) {
-    int tp;
+    struct timespec tp, start;
     so_debug("< [@param pidCliente:%d]", pidCliente); 
 
-    tp = rand() % MAX_ESPERA + 1; // Gera um tempo de espera aleatório
-    so_success("SD12", "%d", tp); // Registra sucesso com o tempo gerado
-    sleep(tp); // Espera pelo tempo aleatório
-    kill(pidCliente, SIGUSR1); // Envia sinal SIGUSR1 ao cliente após a espera
+    double delayMs = processingDelayMs(); // Gera um tempo de espera segundo o modelo de --delay
+    so_success("SD12", "%.0f ms", delayMs); // Registra sucesso com o tempo gerado
+    tp.tv_sec = (time_t) (delayMs / 1000);
+    tp.tv_nsec = (long) ((delayMs - tp.tv_sec * 1000.0) * 1000000);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (inThread() && sleepThread(&tp)) {  // --threads: S6 cancelou a thread durante a espera (em vez do SIGUSR2)
+        so_success("SD14", "SD: Recebi pedido do Servidor para terminar");
+        return;                            // Sem resposta, como em SD14, mas SD13 ainda fecha a sessão
+    }
+    while (!inThread() && nanosleep(&tp, &tp) == -1 && errno == EINTR); // Espera pelo tempo sorteado, mesmo se interrompida
+    delayMicros = elapsedMicros(&start);
+    sendReply(currentRequest, REPLY_OK); // Envia o resultado ao cliente após a espera (ou SIGUSR1, se não tiver FIFO)
     return; // Encerra a função
 
     so_debug(">"); 
 }
 
 
+/**
+ * @brief Envia ao Cliente o resultado do pedido: escreve um ReplyFrame no FIFO de resposta do Cliente
+ *        ("<pidCliente>.fifo") ou, se o Cliente não o tiver criado, envia SIGUSR1 (sucesso) ou SIGHUP (erro)
+ * @param request O pedido do cliente (com nome e nrVoo preenchidos por SD11, em caso de sucesso)
+ * @param status  REPLY_OK, ou o motivo do erro
+ */
+static void sendReply (const CheckIn *request, int status) {
+    char nameFifo[32];
+    struct stat statFifo;
+    ReplyFrame reply = {
+        .magic = REPLY_MAGIC, .version = REPLY_VERSION, .length = sizeof(ReplyFrame),
+        .status = status, .nif = request->nif, .pidServidorDedicado = servidorDedicadoId(),
+        .lookupMicros = lookupMicros, .checkinMicros = checkinMicros, .delayMicros = delayMicros
+    };
+    if (status == REPLY_OK) {
+        strncpy(reply.nome, request->nome, sizeof(reply.nome) - 1);
+        strncpy(reply.nrVoo, request->nrVoo, sizeof(reply.nrVoo) - 1);
+    }
+    reply.totalMicros = elapsedMicros(&requestStart);
+
+    // O_NONBLOCK: se o Cliente já não estiver à escuta, open() falha com ENXIO em vez de bloquear
+    replyFifoName(request->pidCliente, nameFifo, sizeof(nameFifo));
+    int fd = open(nameFifo, O_WRONLY | O_NONBLOCK);
+    if (fd != -1 && fstat(fd, &statFifo) == 0 && S_ISFIFO(statFifo.st_mode) &&
+            write(fd, &reply, sizeof(reply)) == sizeof(reply)) {   // Escrita atómica (< PIPE_BUF)
+        close(fd);
+        so_debug("Resposta %d escrita em %s", status, nameFifo);
+        return;
+    }
+    if (fd != -1)
+        close(fd);
+    kill(request->pidCliente, status == REPLY_OK ? SIGUSR1 : SIGHUP);
+}
+
 /**
  * @brief SD13          Ler a descrição da tarefa SD13 no enunciado
  * @param clientRequest O endereço do pedido do cliente
@@ -399,33 +1328,72 @@ void closeSessionDB_SD13 (CheckIn clientRequest, char *nameDB, int indexClient)
     FILE *fileDB;
     long fileOffset;
 
+    // Só limpa a sessão se ainda for deste Servidor Dedicado: outro check-in do mesmo NIF pode ter escrito entretanto
+    Bd *bd = bdFind(nameDB);
+    if (bd) {   // BD aberta no passo S1: basta limpar os PIDs do registo (na memória partilhada, ou com um pwrite())
+        int pidServidorDedicado, cleared;
+        so_success("SD13.1", "");
+        if (lockRecordDB(bd->fd, indexClient, F_WRLCK) != 0 || bdReadPidServidor(bd, indexClient, &pidServidorDedicado) != 0) {
+            lockRecordDB(bd->fd, indexClient, F_UNLCK);
+            so_error("SD13.2", "");
+            exitServidorDedicado(1);
+        }
+        so_success("SD13.2", "");
+        if (pidServidorDedicado != servidorDedicadoId()) {
+            // A sessão no registo já é de outro SD, mas a deste fecha na mesma: o diário tem de o registar
+            lockRecordDB(bd->fd, indexClient, F_UNLCK);
+            atomic_fetch_add(&stats->sessionsKept, 1);
+            journalCloseSession(clientRequest.nif, indexClient);
+            so_success("SD13.3", "");
+            exitServidorDedicado(0);
+        }
+        cleared = bdWritePids(bd, indexClient, -1, -1);
+        lockRecordDB(bd->fd, indexClient, F_UNLCK);
+        if (cleared != 0) {
+            so_error("SD13.3", "");
+            exitServidorDedicado(1);
+        }
+        journalCloseSession(clientRequest.nif, indexClient);
+        so_success("SD13.3", "");
+        exitServidorDedicado(0);
+    }
+
     fileDB = fopen(nameDB, "r+"); // Abre a base de dados para leitura e escrita
     if (!fileDB) {
         so_error("SD13.1", "", nameDB); // Registra erro se falhar
-        exit(1); // Encerra o programa devido ao erro
+        exitServidorDedicado(1); // Encerra o programa devido ao erro
     }
     so_success("SD13.1", "", nameDB); // Registra sucesso na abertura do arquivo
 
-    clientRequest.pidCliente = -1; // Redefine o PID do cliente
-    clientRequest.pidServidorDedicado = -1; // Redefine o PID do servidor dedicado
-
-    fileOffset = indexClient * sizeof(CheckIn); // Calcula o deslocamento no arquivo
-    if (fseek(fileDB, fileOffset, SEEK_SET) != 0) {
+    fileOffset = bdRecordOffset(&dbHeader, indexClient); // Calcula o deslocamento no arquivo
+    if (lockRecordDB(fileno(fileDB), indexClient, F_WRLCK) != 0 || fseek(fileDB, fileOffset, SEEK_SET) != 0 ||
+            fread(&clientRequest, sizeof(CheckIn), 1, fileDB) != 1 || fseek(fileDB, fileOffset, SEEK_SET) != 0) {
         fclose(fileDB); // Fecha o arquivo se falhar no posicionamento
         so_error("SD13.2", "", nameDB); 
-        exit(1); // Encerra o programa devido ao erro
+        exitServidorDedicado(1); // Encerra o programa devido ao erro
     }
     so_success("SD13.2", "", nameDB); // Registra sucesso no posicionamento
 
+    if (clientRequest.pidServidorDedicado != servidorDedicadoId()) {
+        atomic_fetch_add(&stats->sessionsKept, 1);
+        fclose(fileDB);
+        journalCloseSession(clientRequest.nif, indexClient);
+        so_success("SD13.3", "", nameDB);
+        exitServidorDedicado(0);
+    }
+    clientRequest.pidCliente = -1; // Redefine o PID do cliente
+    clientRequest.pidServidorDedicado = -1; // Redefine o PID do servidor dedicado
+
     if (fwrite(&clientRequest, sizeof(CheckIn), 1, fileDB) != 1) {
         fclose(fileDB); // Fecha o arquivo se falhar na escrita
         so_error("SD13.3", "", nameDB); 
-        exit(1); // Encerra o programa devido ao erro
+        exitServidorDedicado(1); // Encerra o programa devido ao erro
     }
+    journalCloseSession(clientRequest.nif, indexClient);
     so_success("SD13.3", "", nameDB); // Registra sucesso na remoção dos dados
 
     fclose(fileDB); // Fecha o arquivo após a operação bem-sucedida
-    exit(0); // Encerra o programa
+    exitServidorDedicado(0); // Encerra o programa
 }
 
 
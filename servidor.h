@@ -0,0 +1,115 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: servidor.h
+ ** Descrição/Explicação do Módulo:
+ **     Definições partilhadas pelos módulos do Servidor (servidor.c e servidor_*.c)
+ **
+ ******************************************************************************/
+#ifndef __SERVIDOR_H__
+#define __SERVIDOR_H__
+
+#include <setjmp.h>
+#include <stdatomic.h>
+#include "common.h"
+#include "pidset.h"
+#include "bd.h"
+#include "bd_commit.h"
+
+/*** Modelo do tempo de processamento simulado em SD12 (--delay) ***/
+typedef enum { DELAY_NONE, DELAY_FIXED, DELAY_UNIFORM, DELAY_EXP } DelayKind;
+
+typedef struct {
+    DelayKind kind;
+    double    minMs;   // fixed: duração; uniform: mínimo; exp: média (em milissegundos)
+    double    maxMs;   // uniform: máximo (em milissegundos)
+} DelayModel;
+
+/*** Configuração do Servidor (opções da linha de comandos) ***/
+typedef struct {
+    BdIo io;           // --io pread|stdio|mmap: como os registos da BD são lidos e escritos (--mmap = --io mmap)
+    int journal;       // --journal: diário das sessões, com group commit, reparado no passo S1 (ver bd_journal.h)
+    BdDurability durability; // --durability none|record|group[:MS[,K]]: quando um check-in fica em disco (ver bd_commit.h)
+    int poolSize;      // --prefork N: nº de Servidores Dedicados criados no arranque (0 = um fork() por pedido)
+    int poolRecycle;   // --recycle M: nº de pedidos tratados por cada Servidor Dedicado do pool antes de ser substituído
+    int threads;       // --threads N: os pedidos são tratados por N threads do próprio Servidor, em vez de processos (0 = fork())
+    int textProtocol;  // --text-protocol: os pedidos chegam no formato de texto original, em vez de RequestFrame
+    int ring;          // --ring: os Clientes podem enviar os pedidos por um anel em memória partilhada (ver request_ring.h)
+    int eventLoop;     // --event-loop: o Servidor usa um ciclo de eventos (epoll + signalfd + pidfd) em vez do CICLO1
+    int shards;        // --shards N: a BD está repartida por N ficheiros, escolhidos pelo NIF (0 = um só; ver bd_shard.h)
+    int sweepRate;     // --sweep N: registos por segundo verificados pelo sweeper de sessões abandonadas (0 = sem sweeper)
+    int quickShutdown; // --quick-shutdown: S6 só avisa os SDs que o Servidor conhece, sem percorrer a BD
+    DelayModel delay;  // --delay MODELO: tempo de processamento simulado em SD12 (por omissão, uniform:1000-MAX_ESPERA*1000)
+} ServidorConfig;
+
+/*** Estatísticas partilhadas pelo Servidor e por todos os Servidores Dedicados (mostradas em S6) ***/
+typedef struct {
+    atomic_long checkins;          // Nº de check-ins escritos na BD (SD11)
+    atomic_long lockContention;    // Nº de vezes que o lock de um registo estava ocupado por outro processo
+    atomic_long sessionCollisions; // Nº de check-ins (SD11) sobre um registo com uma sessão ainda aberta
+    atomic_long sessionsKept;      // Nº de fins de sessão (SD13) que não limparam o registo, já de outro SD
+    atomic_long sweepPasses;       // --sweep: nº de passagens completas pela BD
+    atomic_long sweptRecords;      // --sweep: nº de registos verificados
+    atomic_long sessionsSwept;     // --sweep: nº de sessões de Servidores Dedicados que já não existiam limpas
+} ServidorStats;
+
+#define POOL_RECYCLE_DEFAULT 1000   // Valor por omissão de --recycle
+#define REQUEST_BATCH_MAX    64     // Nº máximo de pedidos lidos do FIFO de uma só vez (S4)
+#define REQUEST_BUFFER_SIZE  4096   // Tamanho do buffer de leitura do FIFO (S4)
+#define REQUEST_TEXT_MAX     128    // Tamanho máximo de um pedido no protocolo de texto
+
+extern ServidorConfig config;       // Configuração do Servidor, preenchida por parseArguments()
+extern CheckIn clientRequest;       // Variável que tem o pedido enviado do Cliente para o Servidor
+extern _Thread_local sigjmp_buf *requestEnd; // Ponto de retorno no fim de cada pedido, nos Servidores Dedicados reutilizáveis
+extern int requestFifo;             // FIFO do servidor, aberto em S2 durante toda a vida do Servidor
+extern ServidorStats *stats;        // Estatísticas em memória partilhada (criadas antes de S1)
+extern PidSet liveServidores;       // PIDs dos Servidores Dedicados vivos (S5 acrescenta, S8 retira)
+
+int  readRequestBatch_S4 (char *, CheckIn *, int); // S4: lê um lote de pedidos do FIFO
+void closeRequestFifo ();           // Fecha o FIFO do servidor (nos Servidores Dedicados)
+void detachServidorDedicado ();     // Liberta, num Servidor Dedicado, os recursos que só o Servidor usa
+void runServidorDedicado (CheckIn *); // SD9..SD13 para o pedido (clientRequest, ou o de uma thread)
+void exitServidorDedicado (int);    // Termina o pedido atual (exit(), ou regresso a requestEnd)
+pid_t forkServidorDedicado ();      // fork() de um Servidor Dedicado, registado em liveServidores
+void reapServidorDedicado (int);    // Regista o fim de um Servidor Dedicado já recolhido com wait() (S8)
+int  lockRecordDB (int, int, short); // Bloqueia (fcntl) um registo da BD, ou toda a BD com -1
+uint32_t elapsedMicros (const struct timespec *); // Tempo decorrido desde um instante (CLOCK_MONOTONIC), em µs
+
+/* servidor_pool.c: pool de Servidores Dedicados pré-criados (--prefork) */
+void createPool ();                 // Cria os Servidores Dedicados do pool
+void refillPool ();                 // Substitui os Servidores Dedicados do pool que já terminaram
+int  dispatchPool (CheckIn);        // Entrega o pedido a um Servidor Dedicado livre (0), ou -1 se não houver
+int  reapPool (int);                // Regista o fim de um Servidor Dedicado do pool (TRUE se pertencia ao pool)
+
+/* servidor_eventloop.c: ciclo de eventos epoll + signalfd + pidfd (--event-loop) */
+void initEventLoop ();              // Cria o epoll e o signalfd, e bloqueia SIGINT/SIGCHLD
+void runEventLoop ();               // Ciclo de eventos que substitui o CICLO1 (nunca regressa)
+void watchChild (int);              // Acompanha o fim de um Servidor Dedicado através de um pidfd
+void watchBackground (int);         // Acompanha o fim de um processo de segundo plano do passo S1 (flusher, sweeper)
+void leaveEventLoop ();             // Fecha os descritores do ciclo de eventos num processo filho
+
+/* servidor_threads.c: Servidores Dedicados em threads do próprio Servidor (--threads) */
+void createThreads ();              // Cria a fila de pedidos e as config.threads threads
+int  dispatchThreads (CheckIn);     // Põe o pedido na fila das threads (0), ou -1 sem --threads
+void stopThreads ();                // S6: cancela as threads (em vez do SIGUSR2) e espera que terminem
+int  sleepThread (struct timespec *); // SD12: espera que só o cancelamento interrompe (TRUE se a thread foi cancelada)
+int  inThread ();                   // TRUE numa thread de --threads
+pid_t servidorDedicadoId ();        // Identificador do Servidor Dedicado na BD: o PID, ou o TID da thread
+void lockRecordThreads (int, short); // Exclusão entre as threads num registo (os locks fcntl() são do processo)
+void lockIndexThreads (short);      // Exclusão entre as threads nas inserções no índice
+
+/* servidor_ring.c: anel de pedidos em memória partilhada (--ring) */
+int  createRequestRing (int);       // S2: cria o anel, com o nome derivado do FIFO do servidor aberto em fd (0 = sucesso)
+int  requestRingTurn ();            // S4: TRUE se o anel deve ser lido antes do FIFO
+int  readRequestRing (CheckIn *, int); // S4: lê os pedidos completos do anel, sem chamadas ao sistema
+int  sleepRequestRing ();           // S4: marca o Servidor como parado; devolve o tempo máximo de espera no FIFO (ms)
+int  requestRingStallMs ();         // S4: tempo até a posição de um Cliente atrasado poder ser saltada (ms, -1 sem atraso)
+void wakeRequestRing ();            // S4: o Servidor já não está parado
+void requestRingStats ();           // S6: mostra as estatísticas do anel
+void deleteRequestRing ();          // S7: fecha e remove o anel
+
+/* servidor_sweeper.c: limpeza em segundo plano das sessões abandonadas na BD (--sweep) */
+void startSweeper (const char *, const BdHeader *, int); // Cria o processo sweeper de um ficheiro da BD (passo S1)
+int  servidorDedicadoAlive (pid_t); // TRUE se o PID ainda é um processo vivo do executável do Servidor
+
+#endif  // __SERVIDOR_H__
@@ -0,0 +1,200 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: servidor_eventloop.c
+ ** Descrição/Explicação do Módulo:
+ **     Ciclo de eventos do Servidor (--event-loop). Em vez de bloquear em read() no
+ **     passo S4 e de tratar SIGINT (S6) e SIGCHLD (S8) em manipuladores de sinais,
+ **     uma única thread espera com epoll pelo FIFO de pedidos, por um signalfd com
+ **     SIGINT/SIGCHLD e por um pidfd de cada Servidor Dedicado, tratando cada evento
+ **     fora de qualquer manipulador de sinais.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "servidor.h"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+
+#define EVENT_LOOP_MAX_EVENTS 256    // Nº máximo de eventos tratados por cada epoll_wait()
+#define EVENT_FIFO   0               // epoll_data.u64 do FIFO de pedidos
+#define EVENT_SIGNAL 1               // epoll_data.u64 do signalfd
+// Os pidfds são registados com epoll_data.u64 = (pid << 32) | pidfd, pelo que nunca valem 0 nem 1
+
+static int epollFd = -1;             // Descritor do epoll (-1 fora do modo --event-loop)
+static int signalFd = -1;            // signalfd que recebe SIGINT e SIGCHLD
+static sigset_t previousMask;        // Máscara de sinais antes do ciclo de eventos (reposta nos filhos)
+static PidSet untrackedChildren;     // Filhos sem pidfd, que só podem ser recolhidos via SIGCHLD (SDs e processos do S1)
+
+/**
+ * @brief Regista no epoll o descritor fd, identificado por data
+ */
+static int watchFd (int fd, uint64_t data) {
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = data };
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/**
+ * @brief Passa a acompanhar o fim do filho pid através de um pidfd. Se não for possível (e.g., limite
+ *        de descritores atingido), o filho será recolhido quando chegar o SIGCHLD
+ * @param pid PID do Servidor Dedicado acabado de criar
+ */
+void watchChild (int pid) {
+    if (epollFd == -1)
+        return;
+    int pidFd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidFd == -1 || watchFd(pidFd, ((uint64_t) pid << 32) | (uint32_t) pidFd) == -1) {
+        if (pidFd != -1)
+            close(pidFd);
+        if (pidSetAdd(&untrackedChildren, pid) == -1)
+            so_error("S5", "Servidor: SD %d não poderá ser recolhido", pid);
+    }
+}
+
+/**
+ * @brief Passa a acompanhar o fim de um processo de segundo plano criado no passo S1 (o flusher ou um sweeper).
+ *        Como é criado antes do ciclo de eventos, é recolhido quando chegar o SIGCHLD. Sem --event-loop, é o
+ *        S8 do CICLO1 que o recolhe
+ * @param pid PID do processo
+ */
+void watchBackground (int pid) {
+    if (config.eventLoop && pidSetAdd(&untrackedChildren, pid) == -1)
+        so_error("S1", "Servidor: o processo %d não poderá ser recolhido", pid);
+}
+
+/**
+ * @brief S8 (ciclo de eventos) Recolhe o filho cujo pidfd ficou disponível para leitura
+ */
+static void reapChild (uint64_t data) {
+    int pid = data >> 32, pidFd = (uint32_t) data;
+    siginfo_t info = { 0 };
+
+    if (waitid(P_PIDFD, pidFd, &info, WEXITED | WNOHANG) == 0 && info.si_pid == pid) {
+        so_success("S8", "Servidor: Confirmo fim de SD %d", pid);
+        reapServidorDedicado(pid);
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, pidFd, NULL);
+    close(pidFd);
+}
+
+/**
+ * @brief S8 (ciclo de eventos) Recolhe os filhos sem pidfd que já terminaram. Cada um é esperado pelo seu PID, para
+ *        que nunca se recolha um filho com pidfd (esse fica para reapChild())
+ */
+static void reapUntracked () {
+    int status;
+    for (size_t i = 0; i < untrackedChildren.nSlots; ) {
+        pid_t pid = untrackedChildren.slots[i];
+        if (pid <= 0 || waitpid(pid, &status, WNOHANG) != pid) {
+            i++;
+            continue;
+        }
+        // Sem avançar i: pidSetRemove() pode ter deslocado para esta entrada um PID ainda não visto
+        pidSetRemove(&untrackedChildren, pid);
+        if (pidSetContains(&liveServidores, pid)) {
+            so_success("S8", "Servidor: Confirmo fim de SD %d", pid);
+            reapServidorDedicado(pid);
+        }
+    }
+}
+
+/**
+ * @brief Lê os sinais pendentes do signalfd: SIGINT inicia o shutdown (S6), SIGCHLD recolhe filhos (S8)
+ */
+static void handleSignals () {
+    struct signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGINT)
+            trataSinalSIGINT_S6(SIGINT);     // Chamada fora de qualquer manipulador; termina em S7
+        else if (info.ssi_signo == SIGCHLD)
+            reapUntracked();
+    }
+}
+
+/**
+ * @brief S4+S5 (ciclo de eventos) Lê todos os pedidos disponíveis no FIFO e cria um Servidor Dedicado para cada um.
+ *        O epoll só volta a avisar quando chegarem mais dados ao FIFO, pelo que o ciclo só termina quando
+ *        readRequestBatch_S4() devolve 0: FIFO vazio (EAGAIN) e nenhum pedido completo ainda no buffer de S4
+ */
+static void handleRequests () {
+    CheckIn requests[REQUEST_BATCH_MAX];
+    int numRequests;
+
+    while ((numRequests = readRequestBatch_S4(FILE_REQUESTS, requests, REQUEST_BATCH_MAX)) > 0) {
+        for (int i = 0; i < numRequests; i++) {
+            clientRequest = requests[i];
+            if (dispatchThreads(clientRequest) == 0 || dispatchPool(clientRequest) == 0)
+                continue;
+            int pidServidorDedicado = createServidorDedicado_S5();
+            if (pidServidorDedicado > 0) {
+                watchChild(pidServidorDedicado);
+                continue;
+            }
+            runServidorDedicado(&clientRequest); // Servidor Dedicado: SD9..SD13, nunca regressa
+        }
+    }
+}
+
+/**
+ * @brief Liberta, num processo filho, os descritores do ciclo de eventos e repõe a máscara de sinais
+ */
+void leaveEventLoop () {
+    if (epollFd == -1)
+        return;
+    close(epollFd);
+    close(signalFd);
+    epollFd = signalFd = -1;
+    sigprocmask(SIG_SETMASK, &previousMask, NULL);
+}
+
+/**
+ * @brief Prepara o ciclo de eventos. Deve ser chamada antes de createPool(), para que os Servidores
+ *        Dedicados do pool também sejam acompanhados por pidfd
+ */
+void initEventLoop () {
+    sigset_t mask;
+    so_debug("<");
+
+    // SIGINT e SIGCHLD ficam bloqueados: só são recebidos através do signalfd, nunca em manipuladores
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, &previousMask) == -1 ||
+            (signalFd = signalfd(-1, &mask, SFD_NONBLOCK)) == -1 ||
+            (epollFd = epoll_create1(0)) == -1 ||
+            fcntl(requestFifo, F_SETFL, fcntl(requestFifo, F_GETFL) | O_NONBLOCK) == -1 ||
+            watchFd(requestFifo, EVENT_FIFO) == -1 || watchFd(signalFd, EVENT_SIGNAL) == -1) {
+        so_error("S4", "Erro ao criar o ciclo de eventos");
+        deleteFifoAndExit_S7();
+    }
+    so_debug(">");
+}
+
+/**
+ * @brief Ciclo de eventos do Servidor. Substitui o CICLO1 de main() e nunca regressa
+ */
+void runEventLoop () {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    so_success("S4", "Servidor: Ciclo de eventos iniciado");
+
+    while (TRUE) {
+        // --ring: com um Cliente atrasado no anel, o epoll_wait() acaba quando a sua posição pode ser saltada
+        int numEvents = epoll_wait(epollFd, events, EVENT_LOOP_MAX_EVENTS, requestRingStallMs());
+        if (numEvents == -1 && errno != EINTR) {
+            so_error("S4", "epoll_wait");
+            deleteFifoAndExit_S7();
+        }
+        if (numEvents == 0)
+            handleRequests();
+        for (int i = 0; i < numEvents; i++) {
+            if (events[i].data.u64 == EVENT_FIFO)
+                handleRequests();
+            else if (events[i].data.u64 == EVENT_SIGNAL)
+                handleSignals();
+            else
+                reapChild(events[i].data.u64);
+        }
+    }
+}
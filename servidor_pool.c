@@ -0,0 +1,140 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: servidor_pool.c
+ ** Descrição/Explicação do Módulo:
+ **     Pool de Servidores Dedicados criados no arranque do Servidor (--prefork N).
+ **     Em vez de um fork() por pedido (S5), o Servidor escreve cada pedido num pipe
+ **     partilhado, de onde os Servidores Dedicados livres o retiram para executar os
+ **     passos SD9..SD13. Cada Servidor Dedicado é substituído após --recycle M pedidos
+ **     e, se não houver nenhum livre, o Servidor volta a criar um por pedido (S5).
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "servidor.h"
+#include <sys/mman.h>
+#include <stdatomic.h>
+
+typedef struct {
+    atomic_int idle;                 // Nº de Servidores Dedicados à espera de pedido, ainda sem pedido atribuído
+} PoolShared;
+
+static PoolShared *poolShared;       // Memória partilhada entre o Servidor e o pool (NULL se não houver pool)
+static volatile pid_t *poolWorkers;  // PIDs dos Servidores Dedicados do pool (0 = posição por preencher)
+static int poolPipe[2] = { -1, -1 }; // Fila de pedidos: cada write() de um CheckIn é atómico (< PIPE_BUF)
+
+/**
+ * @brief Ciclo de um Servidor Dedicado do pool: retira pedidos do pipe e executa SD9..SD13 para cada um
+ */
+static void runPoolWorker () {
+    sigjmp_buf end;
+    CheckIn request;
+    ssize_t bytesRead;
+
+    detachServidorDedicado();
+    signal(SIGINT, SIG_IGN);         // Tal como em SD9, o Servidor Dedicado ignora o SIGINT
+    close(poolPipe[1]);
+    for (int served = 0; !config.poolRecycle || served < config.poolRecycle; served++) {
+        atomic_fetch_add(&poolShared->idle, 1);
+        while ((bytesRead = read(poolPipe[0], &request, sizeof(CheckIn))) == -1 && errno == EINTR);
+        if (bytesRead != sizeof(CheckIn))
+            break;                   // EOF: o Servidor já terminou
+
+        clientRequest = request;
+        requestEnd = &end;
+        if (sigsetjmp(end, 1) == 0)  // SD10..SD13 terminam com exitServidorDedicado(), que regressa aqui
+            runServidorDedicado(&clientRequest);
+        requestEnd = NULL;
+        fflush(stdout);              // Escreve as mensagens de cada pedido de uma só vez, como um SD que termina
+    }
+    exit(0);                         // Reciclagem: o Servidor cria outro Servidor Dedicado para esta posição
+}
+
+/**
+ * @brief Cria o Servidor Dedicado da posição i do pool
+ */
+static void spawnPoolWorker (int i) {
+    pid_t pid = forkServidorDedicado();
+    if (pid == -1) {
+        so_error("S5", "Erro ao criar Servidor Dedicado do pool");
+        return;
+    }
+    if (pid == 0)
+        runPoolWorker();
+    poolWorkers[i] = pid;
+    watchChild(pid);
+    so_success("S5", "Servidor: Iniciei SD %d (pool)", pid);
+}
+
+/**
+ * @brief Cria a memória partilhada, o pipe de pedidos e os config.poolSize Servidores Dedicados do pool
+ */
+void createPool () {
+    so_debug("< [poolSize:%d, poolRecycle:%d]", config.poolSize, config.poolRecycle);
+
+    poolShared = mmap(NULL, sizeof(PoolShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    poolWorkers = calloc(config.poolSize, sizeof(pid_t));
+    if (poolShared == MAP_FAILED || !poolWorkers || pipe(poolPipe) == -1) {
+        so_error("S5", "Erro ao criar o pool de Servidores Dedicados");
+        deleteFifoAndExit_S7();
+    }
+    atomic_init(&poolShared->idle, 0);
+
+    for (int i = 0; i < config.poolSize; i++)
+        spawnPoolWorker(i);
+    so_debug(">");
+}
+
+/**
+ * @brief Substitui os Servidores Dedicados do pool que terminaram (reciclados, ou com erro)
+ */
+void refillPool () {
+    for (int i = 0; poolShared && i < config.poolSize; i++)
+        if (poolWorkers[i] == 0)
+            spawnPoolWorker(i);
+}
+
+/**
+ * @brief Entrega o pedido a um Servidor Dedicado livre do pool
+ * @param request O pedido do cliente
+ * @return int    0 se o pedido foi entregue, -1 se não houver pool ou se estiver esgotado
+ */
+int dispatchPool (CheckIn request) {
+    if (!poolShared)
+        return -1;
+    refillPool();
+
+    int idle = atomic_load(&poolShared->idle);
+    do {
+        if (idle <= 0) {
+            so_debug("Pool esgotado: fork() por pedido");
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak(&poolShared->idle, &idle, idle - 1));
+
+    ssize_t bytesWritten;
+    while ((bytesWritten = write(poolPipe[1], &request, sizeof(CheckIn))) == -1 && errno == EINTR);
+    if (bytesWritten != sizeof(CheckIn)) {
+        atomic_fetch_add(&poolShared->idle, 1);
+        so_error("S5", "Erro ao entregar o pedido ao pool");
+        return -1;
+    }
+    so_success("S5", "Servidor: Pedido %d entregue ao pool", request.nif);
+    return 0;
+}
+
+/**
+ * @brief Regista o fim de um Servidor Dedicado, se pertencer ao pool (chamada por S8)
+ * @param pid O PID do Servidor Dedicado que terminou
+ * @return int TRUE se pertencia ao pool
+ */
+int reapPool (int pid) {
+    for (int i = 0; poolShared && i < config.poolSize; i++) {
+        if (poolWorkers[i] == pid) {
+            poolWorkers[i] = 0;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
@@ -0,0 +1,209 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: servidor_ring.c
+ ** Descrição/Explicação do Módulo:
+ **     Lado do Servidor do anel de pedidos em memória partilhada (--ring; ver
+ **     request_ring.h). O anel é criado no passo S2, a seguir ao FIFO, e lido em S4
+ **     antes do FIFO. Enquanto houver pedidos no anel, S4 não faz chamadas ao
+ **     sistema; com o anel vazio, o Servidor marca-se como parado e bloqueia no FIFO,
+ **     como sem --ring, até chegar um pedido pelo FIFO ou o byte de um Cliente do
+ **     anel. O FIFO continua a ser lido de tempos a tempos com o anel ocupado, para
+ **     os Clientes que o usam (sem --ring, ou com o anel cheio) não ficarem à espera.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "servidor.h"
+#include "request_ring.h"
+#include <poll.h>
+
+#define RING_STALL_MS       20       // Espera máxima por um Cliente que reservou uma posição e não a preencheu
+#define RING_STALL_POLL_MS  1        // Espera no FIFO por um pedido reservado depois da última leitura do anel
+#define RING_FIFO_EVERY     16       // Com o anel ocupado, o FIFO é verificado uma vez em cada RING_FIFO_EVERY lotes
+
+static RequestRing *ring;            // O anel (NULL sem --ring)
+static char ringName[64];            // Nome do anel para shm_open()/shm_unlink()
+static int stalled = FALSE;          // A posição tail tem um Cliente atrasado, desde stallStart
+static struct timespec stallStart;
+static long consumed, skipped, sleeps; // Só o Servidor consome o anel, pelo que estes contadores não são partilhados
+
+/**
+ * @brief S2 Cria o anel de pedidos, com o nome derivado do FIFO do servidor já aberto em fifoFd
+ * @return int 0 em caso de sucesso, -1 em caso de erro
+ */
+int createRequestRing (int fifoFd) {
+    struct stat fifo;
+    so_debug("<");
+
+    if (fstat(fifoFd, &fifo) == -1)
+        return -1;
+    requestRingName(&fifo, ringName, sizeof(ringName));
+    shm_unlink(ringName);            // Deixado por um Servidor que não chegou a S7, com um FIFO no mesmo inode
+    int fd = shm_open(ringName, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd == -1)
+        return -1;
+    if (ftruncate(fd, sizeof(RequestRing)) == -1 ||
+            (ring = mmap(NULL, sizeof(RequestRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        shm_unlink(ringName);
+        ring = NULL;
+        return -1;
+    }
+    close(fd);
+
+    for (uint64_t i = 0; i < REQUEST_RING_SLOTS; i++)
+        atomic_init(&ring->slot[i].sequence, RING_SEQUENCE(i, RING_FREE));
+    ring->version = REQUEST_RING_VERSION;
+    ring->slotSize = sizeof(RequestRingSlot);
+    ring->slots = REQUEST_RING_SLOTS;
+    ring->serverPid = getpid();
+    atomic_init(&ring->sleeping, 1);  // Até ao primeiro S4: com --event-loop, só o FIFO acorda o Servidor
+    atomic_thread_fence(memory_order_release);
+    ring->magic = REQUEST_RING_MAGIC;   // Por último: um Cliente nunca usa um anel a meio de ser preparado
+    so_success("S2", "Servidor: anel de pedidos %s com %d posições", ringName, REQUEST_RING_SLOTS);
+    so_debug(">");
+    return 0;
+}
+
+/**
+ * @brief TRUE se S4 deve ler o anel antes do FIFO. Sem --ring, ou numa vez em cada RING_FIFO_EVERY com pedidos à
+ *        espera no FIFO, é FALSE, e S4 lê logo o FIFO (sem bloquear, porque já tem dados)
+ */
+int requestRingTurn () {
+    static unsigned turns = 0;
+    if (!ring)
+        return FALSE;
+    return ++turns % RING_FIFO_EVERY != 0 || poll(&(struct pollfd) { .fd = requestFifo, .events = POLLIN }, 1, 0) != 1;
+}
+
+/**
+ * @brief S4 Lê do anel os pedidos já completos, por ordem, sem chamadas ao sistema. Uma posição reservada por um
+ *        Cliente que não a preenche em RING_STALL_MS é saltada: o Cliente, ao ver isso, envia o pedido pelo FIFO
+ * @param requests Onde colocar os pedidos lidos
+ * @param max      Nº máximo de pedidos a ler
+ * @return int     Nº de pedidos válidos colocados em requests
+ */
+int readRequestRing (CheckIn *requests, int max) {
+    int numRequests = 0;
+    if (!ring)
+        return 0;
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (numRequests < max && tail < head) {
+        RequestRingSlot *slot = &ring->slot[tail & (REQUEST_RING_SLOTS - 1)];
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if (sequence == RING_SEQUENCE(tail, RING_READY)) {
+            RequestFrame frame = slot->frame;
+            atomic_store_explicit(&slot->sequence, RING_SEQUENCE(tail + REQUEST_RING_SLOTS, RING_FREE), memory_order_release);
+            tail++;
+            consumed++;
+            stalled = FALSE;
+            CheckIn *request = &requests[numRequests];
+            if (requestFrameDecode(&frame, request) == 0) {
+                so_success("S4", "%d %s %d", request->nif, request->senha, request->pidCliente);
+                numRequests++;
+            } else {
+                so_error("S4", "Pedido inválido");
+            }
+            continue;
+        }
+        if (sequence >> 2 < tail) {
+            // Posição presa numa volta anterior, por um Cliente saltado que ainda não a devolveu (SKIPPED), ou
+            // devolvida tarde de mais (FREE): o Cliente deste ticket já seguiu pelo FIFO
+            uint64_t expected = sequence;
+            if ((sequence & 3) == RING_FREE)
+                atomic_compare_exchange_strong(&slot->sequence, &expected, RING_SEQUENCE(tail + REQUEST_RING_SLOTS, RING_FREE));
+            tail++;
+            skipped++;
+            continue;
+        }
+
+        // O Cliente do ticket tail ainda não escreveu (FREE) ou não acabou de escrever (WRITING) o pedido
+        if (!stalled) {
+            clock_gettime(CLOCK_MONOTONIC, &stallStart);
+            stalled = TRUE;
+        }
+        if (elapsedMicros(&stallStart) < RING_STALL_MS * 1000)
+            break;
+        // Um Cliente que ainda não escreveu não vai escrever; a um que está a escrever, a posição só é devolvida
+        // quando ele acabar (SKIPPED), para nunca haver dois Clientes a escrever na mesma trama
+        uint64_t skip = (sequence & 3) == RING_FREE ? RING_SEQUENCE(tail + REQUEST_RING_SLOTS, RING_FREE)
+                                                    : RING_SEQUENCE(tail, RING_SKIPPED);
+        if (atomic_compare_exchange_strong(&slot->sequence, &sequence, skip)) {
+            so_error("S4", "Posição %llu do anel abandonada por um Cliente", (unsigned long long) tail);
+            tail++;
+            skipped++;
+            stalled = FALSE;
+        }   // Se falhou, o Cliente acabou entretanto: a posição volta a ser lida
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    return numRequests;
+}
+
+/**
+ * @brief S4 Tempo até a posição do Cliente atrasado poder ser saltada por readRequestRing(). Com --event-loop, é o
+ *        timeout do epoll_wait(): o S4 nunca espera pelo Cliente dentro do ciclo de eventos
+ * @return int Tempo em ms (0 se já pode ser saltada), ou -1 se nenhum Cliente estiver atrasado
+ */
+int requestRingStallMs () {
+    if (!ring || !stalled)
+        return -1;
+    long remaining = RING_STALL_MS * 1000L - elapsedMicros(&stallStart);
+    return remaining > 0 ? (remaining + 999) / 1000 : 0;
+}
+
+/**
+ * @brief S4 Marca o Servidor como parado, antes de bloquear no FIFO. Um Cliente que publique um pedido depois disto
+ *        vê a marca e acorda-o com um byte no FIFO (ver requestRingWrite())
+ * @return int Tempo máximo de espera no FIFO, em ms: -1 (sem limite), 0 (já há um pedido no anel, ou uma posição a
+ *             saltar: não esperar) ou o tempo até a posição de um Cliente atrasado poder ser saltada. Se o Cliente
+ *             acabar antes, o byte que envia pelo FIFO acorda o Servidor
+ */
+int sleepRequestRing () {
+    if (!ring)
+        return -1;
+    atomic_store(&ring->sleeping, 1);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (atomic_load(&ring->head) == tail) {
+        sleeps++;
+        return -1;
+    }
+    uint64_t sequence = atomic_load(&ring->slot[tail & (REQUEST_RING_SLOTS - 1)].sequence);
+    if (sequence == RING_SEQUENCE(tail, RING_READY) || sequence >> 2 < tail)
+        return 0;
+    int stallMs = requestRingStallMs();
+    return stallMs == -1 ? RING_STALL_POLL_MS : stallMs;
+}
+
+/**
+ * @brief S4 O Servidor deixou de estar parado: os Clientes do anel já não precisam de o acordar
+ */
+void wakeRequestRing () {
+    if (ring)
+        atomic_store(&ring->sleeping, 0);
+}
+
+/**
+ * @brief S6 Mostra quantos pedidos chegaram pelo anel, quantos seguiram pelo FIFO e quantas vezes o Servidor parou
+ */
+void requestRingStats () {
+    if (!ring)
+        return;
+    so_success("S6", "Servidor: anel com %ld pedidos, %ld pelo FIFO (anel cheio ou posição perdida), %ld posições saltadas, "
+               "%ld paragens, %ld despertares pelo FIFO", consumed, atomic_load(&ring->fallbacks), skipped, sleeps,
+               atomic_load(&ring->doorbells));
+}
+
+/**
+ * @brief S7 Fecha o anel aos Clientes e remove-o. Só o Servidor que o criou o remove
+ */
+void deleteRequestRing () {
+    if (!ring || ring->serverPid != getpid())
+        return;
+    atomic_store(&ring->closed, 1);
+    shm_unlink(ringName);
+    munmap(ring, sizeof(RequestRing));
+    ring = NULL;
+}
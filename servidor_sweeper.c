@@ -0,0 +1,190 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: servidor_sweeper.c
+ ** Descrição/Explicação do Módulo:
+ **     Limpeza, em segundo plano, das sessões abandonadas na BD (--sweep N). Um
+ **     processo criado no passo S1 percorre a BD em blocos, a no máximo N registos
+ **     por segundo, e limpa (PIDs a -1) os registos cujo pidServidorDedicado já não
+ **     é um Servidor Dedicado: processo inexistente, zombie, ou PID reutilizado por
+ **     outro programa. O ciclo S4 nunca espera pelo sweeper, que só bloqueia o
+ **     registo que está a limpar. A mesma verificação evita que S6 envie SIGUSR2 a
+ **     processos que não são Servidores Dedicados.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "servidor.h"
+#include "bd_format.h"
+#include "procutil.h"
+#include <sys/syscall.h>
+
+#define SWEEP_CHUNK    512           // Registos lidos de cada vez (no máximo N, para respeitar o ritmo)
+#define SWEEP_PASS_MS  1000          // Intervalo mínimo entre o início de duas passagens (numa BD pequena)
+
+/**
+ * @brief Lê o estado e o instante de arranque (em ticks desde o boot) do processo pid, de /proc/<pid>/stat
+ * @return int TRUE em caso de sucesso
+ */
+static int readProcessStat (pid_t pid, char *state, unsigned long long *startTime) {
+    char path[64], buffer[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return FALSE;
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (length <= 0)
+        return FALSE;
+    buffer[length] = '\0';
+    char *fields = strrchr(buffer, ')');     // O nome do programa (2º campo) pode conter espaços e parênteses
+    // Campos 3 (estado) a 22 (starttime), depois do nome
+    return fields && sscanf(fields + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+                            state, startTime) == 2;
+}
+
+/**
+ * @brief TRUE se o processo pid corre o mesmo executável que o Servidor (i.e., /proc/<pid>/exe e /proc/self/exe)
+ */
+static int sameExecutable (pid_t pid) {
+    static struct stat self;
+    struct stat other;
+    char path[64];
+    if (self.st_ino == 0 && stat("/proc/self/exe", &self) == -1)
+        return FALSE;
+    snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+    return stat(path, &other) == 0 && other.st_dev == self.st_dev && other.st_ino == self.st_ino;
+}
+
+/**
+ * @brief Verifica se pid ainda é um Servidor Dedicado: existe, não é zombie e corre o executável do Servidor (um
+ *        PID reutilizado por outro programa não conta). O pidfd garante que a informação lida de /proc é do mesmo
+ *        processo; sem pidfd_open(), o instante de arranque, lido antes e depois, tem o mesmo papel. Um PID
+ *        reutilizado por outro Servidor Dedicado (ou outro processo do mesmo executável) não é detetado: o registo
+ *        não guarda o instante de arranque do SD da sessão, pelo que essa sessão fica a contar como em curso
+ * @param pid  O PID guardado em pidServidorDedicado
+ * @return int TRUE se a sessão pode estar em curso
+ */
+int servidorDedicadoAlive (pid_t pid) {
+    char state, stateAfter;
+    unsigned long long startTime, startTimeAfter;
+
+    if (pid <= 0)
+        return FALSE;
+    int pidFd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidFd == -1 && errno == ESRCH)
+        return FALSE;
+    int alive = readProcessStat(pid, &state, &startTime) && state != 'Z' && state != 'X' && sameExecutable(pid);
+    if (pidFd != -1) {
+        alive = alive && syscall(SYS_pidfd_send_signal, pidFd, 0, NULL, 0) == 0;
+        close(pidFd);
+    } else {
+        alive = alive && readProcessStat(pid, &stateAfter, &startTimeAfter) && startTimeAfter == startTime;
+    }
+    return alive;
+}
+
+/**
+ * @brief Lê os PIDs dos registos [first, first + n) da BD aberta em fd, em qualquer dos layouts
+ * @return int 0 em caso de sucesso, -1 em caso de erro
+ */
+static int readSessionPids (int fd, const BdHeader *header, size_t first, size_t n, int *pidCliente, int *pidServidor) {
+    static CheckIn chunk[SWEEP_CHUNK];
+    if (header->layout == BD_LAYOUT_COLUMNS) {
+        ssize_t size = n * sizeof(int);
+        return pread(fd, pidCliente, size, bdFieldOffset(header, first, BD_COL_PID_CLIENTE)) == size &&
+               pread(fd, pidServidor, size, bdFieldOffset(header, first, BD_COL_PID_SERVIDOR)) == size ? 0 : -1;
+    }
+    if (pread(fd, chunk, n * sizeof(CheckIn), bdRecordOffset(header, first)) != (ssize_t) (n * sizeof(CheckIn)))
+        return -1;
+    for (size_t i = 0; i < n; i++) {
+        pidCliente[i] = chunk[i].pidCliente;
+        pidServidor[i] = chunk[i].pidServidorDedicado;
+    }
+    return 0;
+}
+
+/**
+ * @brief Limpa a sessão do registo index, se ainda for do Servidor Dedicado pid (que já não existe). O registo
+ *        fica bloqueado durante a verificação, tal como em SD11 e SD13
+ * @return int TRUE se a sessão foi limpa
+ */
+static int clearSession (int fd, const BdHeader *header, size_t index, int pid) {
+    int current, none = -1, cleared = FALSE;
+    if (lockRecordDB(fd, index, F_WRLCK) != 0)
+        return FALSE;
+    if (pread(fd, &current, sizeof(current), bdFieldOffset(header, index, BD_COL_PID_SERVIDOR)) == sizeof(current) &&
+            current == pid && !servidorDedicadoAlive(pid))
+        cleared = pwrite(fd, &none, sizeof(none), bdFieldOffset(header, index, BD_COL_PID_CLIENTE)) == sizeof(none) &&
+                  pwrite(fd, &none, sizeof(none), bdFieldOffset(header, index, BD_COL_PID_SERVIDOR)) == sizeof(none);
+    lockRecordDB(fd, index, F_UNLCK);
+    return cleared;
+}
+
+static void sleepMicros (long micros) {
+    struct timespec delay = { micros / 1000000, (micros % 1000000) * 1000 };
+    while (nanosleep(&delay, &delay) == -1 && errno == EINTR);
+}
+
+/**
+ * @brief Ciclo do sweeper: percorre a BD indefinidamente, SWEEP_CHUNK registos de cada vez (ou menos, se o ritmo
+ *        for inferior), dormindo entre blocos para não passar de rate registos por segundo
+ */
+static void runSweeper (const char *nameDB, BdHeader header, int rate) {
+    static int pidCliente[SWEEP_CHUNK], pidServidor[SWEEP_CHUNK];
+    size_t chunk = rate < SWEEP_CHUNK ? rate : SWEEP_CHUNK;
+
+    int fd = open(nameDB, O_RDWR);
+    if (fd == -1) {
+        so_error("S1", "Sweeper: erro ao abrir %s", nameDB);
+        exit(1);
+    }
+    for (;;) {
+        struct timespec passStart, chunkStart;
+        clock_gettime(CLOCK_MONOTONIC, &passStart);
+        for (size_t first = 0; first < header.count; first += chunk) {
+            size_t n = header.count - first < chunk ? header.count - first : chunk;
+            clock_gettime(CLOCK_MONOTONIC, &chunkStart);
+            if (readSessionPids(fd, &header, first, n, pidCliente, pidServidor) != 0) {
+                so_error("S1", "Sweeper: erro ao ler %s", nameDB);
+                break;
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (pidServidor[i] <= 0 || servidorDedicadoAlive(pidServidor[i]))
+                    continue;
+                if (clearSession(fd, &header, first + i, pidServidor[i])) {
+                    so_debug("Sweeper: sessão do SD %d (Cliente %d) limpa no registo %zu", pidServidor[i], pidCliente[i], first + i);
+                    atomic_fetch_add(&stats->sessionsSwept, 1);
+                }
+            }
+            atomic_fetch_add(&stats->sweptRecords, n);
+            long budget = n * 1000000L / rate - elapsedMicros(&chunkStart);
+            if (budget > 0)
+                sleepMicros(budget);
+        }
+        atomic_fetch_add(&stats->sweepPasses, 1);
+        long rest = SWEEP_PASS_MS * 1000L - elapsedMicros(&passStart);
+        if (rest > 0)
+            sleepMicros(rest);
+    }
+}
+
+/**
+ * @brief Cria o processo sweeper (--sweep N) de um ficheiro da BD. Chamada pelo Servidor no passo S1, depois de
+ *        validar a BD
+ * @param nameDB O nome do ficheiro da BD
+ * @param header O seu cabeçalho, validado em S1
+ * @param rate   Nº máximo de registos verificados por segundo
+ */
+void startSweeper (const char *nameDB, const BdHeader *header, int rate) {
+    so_debug("< [@param nameDB:%s, rate:%d]", nameDB, rate);
+    pid_t pid = forkBackground();
+    if (pid == -1) {
+        so_error("S1", "Erro ao criar o sweeper");
+        exit(1);
+    }
+    if (pid == 0)
+        runSweeper(nameDB, *header, rate);
+    watchBackground(pid);
+    so_debug("> [sweeper:%d]", pid);
+}
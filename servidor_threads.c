@@ -0,0 +1,281 @@
+/******************************************************************************
+ ** ISCTE-IUL: Trabalho prático 2 de Sistemas Operativos 2023/2024, Enunciado Versão 3+
+ **
+ ** Nome do Módulo: servidor_threads.c
+ ** Descrição/Explicação do Módulo:
+ **     Servidores Dedicados em threads do próprio Servidor (--threads N). Em vez de
+ **     um fork() por pedido (S5), o Servidor distribui os pedidos, à vez, pelas
+ **     filas (deques sem locks) das N threads, que executam os passos SD9..SD13 e,
+ **     quando a sua fila está vazia, roubam pedidos às filas das outras. As threads
+ **     partilham o descritor (ou o mapeamento) da BD aberto em S1. Não há exit() nem
+ **     SIGCHLD por pedido. Na BD, cada thread identifica-se pelo seu TID, e os locks
+ **     fcntl() dos registos, que são do processo, são completados por mutexes entre
+ **     as threads. No shutdown (S6), as threads são canceladas (a espera de SD12 é
+ **     interrompida) em vez de receberem SIGUSR2.
+ **
+ ******************************************************************************/
+
+#define SO_HIDE_DEBUG                // Uncomment this line to hide all @DEBUG statements
+#include "servidor.h"
+#include "procutil.h"
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#define THREADS_DEQUE_SIZE    1024   // Pedidos em cada fila (potência de 2); com todas cheias, S5 faz fork()
+#define THREADS_RECORD_LOCKS  256    // Mutexes dos registos: o registo i usa o mutex i % THREADS_RECORD_LOCKS
+
+/**
+ * Fila de pedidos de uma thread. O único produtor é o Servidor (S5), que escreve o pedido e só depois avança
+ * bottom. A thread dona e as que roubam retiram pedidos do topo, reservando-os com um CAS em top: um pedido
+ * lido por uma thread cujo CAS falhe é descartado, pelo que nunca há dois donos. Como o produtor não é a thread
+ * dona, esta também retira pelo topo (os pedidos são tratados por ordem de chegada)
+ */
+typedef struct {
+    _Alignas(64) atomic_size_t top;  // Próximo pedido a retirar (dona e ladras)
+    _Alignas(64) atomic_size_t bottom; // Próxima posição livre (só o Servidor escreve)
+    long pushed, maxDepth;           // Estatísticas do Servidor: pedidos entregues e maior nº de pedidos na fila
+    _Alignas(64) long served, stolen; // Estatísticas da thread: pedidos tratados e, destes, quantos roubou
+    CheckIn slots[THREADS_DEQUE_SIZE];
+} WorkerDeque;
+
+static int nThreads = 0;             // Nº de threads criadas (0 sem --threads, e nos processos filhos)
+static pthread_t *threads;
+static volatile pid_t *threadIds;    // TID de cada thread, preenchido pela própria thread
+static WorkerDeque *deques;          // Uma fila por thread
+static int nextDeque = 0;            // S5: a fila que recebe o próximo pedido (round-robin)
+static atomic_uint work;             // Futex das threads sem pedidos: incrementado a cada pedido entregue
+static atomic_int sleepers;          // Nº de threads à espera em work
+static atomic_uint stopping;         // S6: futex do cancelamento (1 = as threads terminam)
+static pthread_mutex_t recordLocks[THREADS_RECORD_LOCKS];
+static pthread_mutex_t indexLock;
+static _Thread_local pid_t threadId; // TID desta thread (0 fora das threads de --threads)
+
+/**
+ * @brief Num processo filho (e.g., S5 com todas as filas cheias) não há threads: valem os locks fcntl()
+ */
+static void leaveThreads () {
+    nThreads = 0;
+}
+
+/**
+ * @brief Retira o pedido do topo da fila deque (pela thread dona, ou por outra que o rouba)
+ * @return int TRUE se retirou um pedido
+ */
+static int takeRequest (WorkerDeque *deque, CheckIn *request) {
+    size_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    while (top < atomic_load_explicit(&deque->bottom, memory_order_acquire)) {
+        *request = deque->slots[top % THREADS_DEQUE_SIZE];
+        if (atomic_compare_exchange_weak(&deque->top, &top, top + 1))   // Se falhar, top passa a ser o atual
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Procura um pedido: primeiro na fila da thread self, depois nas das outras, a começar pela seguinte
+ * @return int TRUE se encontrou um pedido
+ */
+static int findRequest (int self, CheckIn *request) {
+    if (takeRequest(&deques[self], request))
+        return TRUE;
+    for (int i = 1; i < nThreads; i++) {
+        if (takeRequest(&deques[(self + i) % nThreads], request)) {
+            deques[self].stolen++;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Ciclo de uma thread: retira pedidos (da sua fila, ou roubados) e executa SD9..SD13 para cada um, até ao
+ *        cancelamento (S6). Sem pedidos em nenhuma fila, espera no futex work
+ */
+static void *runThread (void *arg) {
+    int self = (long) arg;
+    sigjmp_buf end;
+    CheckIn request;                 // O pedido desta thread (o clientRequest global é o do Servidor)
+
+    threadId = syscall(SYS_gettid);
+    threadIds[self] = threadId;
+    so_success("S5", "Servidor: Iniciei SD %d (thread)", threadId);
+    while (!atomic_load(&stopping)) {
+        if (!findRequest(self, &request)) {
+            // sleepers antes da última procura: ou o Servidor vê esta thread à espera, ou ela vê o pedido (ou work alterado)
+            atomic_fetch_add(&sleepers, 1);
+            unsigned seen = atomic_load(&work);
+            int found = !atomic_load(&stopping) && findRequest(self, &request);
+            if (!found)
+                futexWait(&work, seen, -1, FUTEX_PRIVATE_FLAG);
+            atomic_fetch_sub(&sleepers, 1);
+            if (!found)
+                continue;
+        }
+        requestEnd = &end;
+        if (sigsetjmp(end, 0) == 0)  // SD10..SD13 terminam com exitServidorDedicado(), que regressa aqui
+            runServidorDedicado(&request);
+        requestEnd = NULL;
+        deques[self].served++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Cria as filas, os mutexes e as config.threads threads. SIGINT e SIGCHLD ficam bloqueados nas threads,
+ *        para que S6 e S8 corram sempre na thread principal (a do CICLO1, ou a do ciclo de eventos)
+ */
+void createThreads () {
+    pthread_mutexattr_t mutexAttr;
+    sigset_t mask, previous;
+    so_debug("< [threads:%d]", config.threads);
+
+    threads = calloc(config.threads, sizeof(pthread_t));
+    threadIds = calloc(config.threads, sizeof(pid_t));
+    deques = aligned_alloc(_Alignof(WorkerDeque), config.threads * sizeof(WorkerDeque));
+    if (!threads || !threadIds || !deques) {
+        so_error("S5", "Erro ao criar as threads");
+        deleteFifoAndExit_S7();
+    }
+    memset(deques, 0, config.threads * sizeof(WorkerDeque));
+    // PTHREAD_MUTEX_ERRORCHECK: SD11 e SD13 desbloqueiam o registo mesmo quando o lock falhou
+    pthread_mutexattr_init(&mutexAttr);
+    pthread_mutexattr_settype(&mutexAttr, PTHREAD_MUTEX_ERRORCHECK);
+    for (int i = 0; i < THREADS_RECORD_LOCKS; i++)
+        pthread_mutex_init(&recordLocks[i], &mutexAttr);
+    pthread_mutex_init(&indexLock, &mutexAttr);
+    pthread_mutexattr_destroy(&mutexAttr);
+    pthread_atfork(NULL, NULL, leaveThreads);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, &previous);    // Herdada pelas threads
+    nThreads = config.threads;                       // As threads roubam das filas de todas as outras
+    for (int i = 0; i < config.threads; i++) {
+        if (pthread_create(&threads[i], NULL, runThread, (void *) (long) i) != 0) {
+            so_error("S5", "Erro ao criar a thread %d", i);
+            nThreads = i;            // Nenhuma thread criada recebe pedidos (nem rouba) de uma fila além de nThreads
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (nThreads == 0)
+        deleteFifoAndExit_S7();
+    so_debug("> [nThreads:%d]", nThreads);
+}
+
+/**
+ * @brief Põe o pedido na fila da thread seguinte (round-robin) ou, se estiver cheia, na primeira que tiver espaço,
+ *        e acorda uma thread se alguma estiver à espera
+ * @param request O pedido do cliente
+ * @return int    0 se o pedido foi entregue, -1 sem --threads, ou com todas as filas cheias (S5 faz então fork())
+ */
+int dispatchThreads (CheckIn request) {
+    if (nThreads == 0)
+        return -1;
+    for (int i = 0; i < nThreads; i++) {
+        WorkerDeque *deque = &deques[nextDeque];
+        nextDeque = (nextDeque + 1) % nThreads;
+        size_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+        size_t depth = bottom - atomic_load_explicit(&deque->top, memory_order_acquire);
+        if (depth >= THREADS_DEQUE_SIZE)
+            continue;
+        deque->slots[bottom % THREADS_DEQUE_SIZE] = request;
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+        deque->pushed++;
+        if ((long) depth + 1 > deque->maxDepth)
+            deque->maxDepth = depth + 1;
+        atomic_fetch_add(&work, 1);
+        if (atomic_load(&sleepers) > 0)
+            futexWake(&work, 1, FUTEX_PRIVATE_FLAG);
+        so_success("S5", "Servidor: Pedido %d entregue à fila %d", request.nif, (int) (deque - deques));
+        return 0;
+    }
+    so_error("S5", "Filas das threads cheias");
+    return -1;
+}
+
+/**
+ * @brief S6: cancela as threads, espera que terminem e mostra, por thread, os pedidos tratados e roubados e a maior
+ *        fila. Uma thread a meio da espera de SD12 não responde ao Cliente, mas ainda fecha a sessão (SD13), já que
+ *        não termina com o processo
+ */
+void stopThreads () {
+    long dropped = 0, served = 0, stolen = 0;
+    if (nThreads == 0)
+        return;
+    atomic_store(&stopping, 1);
+    futexWake(&stopping, INT_MAX, FUTEX_PRIVATE_FLAG);   // As que estão em SD12
+    atomic_fetch_add(&work, 1);
+    futexWake(&work, INT_MAX, FUTEX_PRIVATE_FLAG);       // As que estão sem pedidos
+
+    for (int i = 0; i < nThreads; i++) {
+        pthread_join(threads[i], NULL);
+        so_success("S6.3", "Servidor: Shutdown SD %d (thread)", threadIds[i]);
+    }
+    for (int i = 0; i < nThreads; i++) {
+        WorkerDeque *deque = &deques[i];
+        long depth = atomic_load(&deque->bottom) - atomic_load(&deque->top);
+        so_success("S6", "Servidor: fila %d (SD %d): %ld pedidos entregues, %ld tratados (%ld roubados), máximo %ld na fila, %ld por tratar",
+                   i, threadIds[i], deque->pushed, deque->served, deque->stolen, deque->maxDepth, depth);
+        dropped += depth;
+        served += deque->served;
+        stolen += deque->stolen;
+    }
+    so_success("S6", "Servidor: %d threads, %ld pedidos tratados, %ld roubados, %ld pedidos por tratar descartados",
+               nThreads, served, stolen, dropped);
+    nThreads = 0;
+}
+
+/**
+ * @brief SD12: espera pelo tempo delay, numa thread. Só o cancelamento (S6) a interrompe
+ * @return int TRUE se a thread foi cancelada antes do fim da espera
+ */
+int sleepThread (struct timespec *delay) {
+    struct timespec start;
+    long total = delay->tv_sec * 1000000L + delay->tv_nsec / 1000, left;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!atomic_load(&stopping) && (left = total - (long) elapsedMicros(&start)) > 0)
+        futexWait(&stopping, 0, left, FUTEX_PRIVATE_FLAG);
+    return atomic_load(&stopping);
+}
+
+int inThread () {
+    return threadId != 0;
+}
+
+/**
+ * @brief O identificador do Servidor Dedicado, guardado em pidServidorDedicado e enviado ao Cliente. Numa thread é
+ *        o TID, único enquanto a thread existir, para que SD13 não confunda a sessão de outra thread com a sua
+ */
+pid_t servidorDedicadoId () {
+    return threadId ? threadId : getpid();
+}
+
+/**
+ * @brief Bloqueia (F_WRLCK ou F_RDLCK) ou desbloqueia (F_UNLCK) o registo indexClient entre as threads, antes do
+ *        lock fcntl() (que só exclui outros processos). Não faz nada sem --threads, nem para toda a BD (-1)
+ */
+void lockRecordThreads (int indexClient, short type) {
+    if (nThreads == 0 || indexClient < 0)
+        return;
+    pthread_mutex_t *lock = &recordLocks[indexClient % THREADS_RECORD_LOCKS];
+    if (type == F_UNLCK) {
+        pthread_mutex_unlock(lock);  // EPERM (ignorado) se esta thread não o tiver
+    } else if (pthread_mutex_trylock(lock) == EBUSY) {
+        atomic_fetch_add(&stats->lockContention, 1);
+        pthread_mutex_lock(lock);
+    }
+}
+
+/**
+ * @brief Bloqueia ou desbloqueia (F_UNLCK) as inserções no índice entre as threads (ver lockRecordThreads())
+ */
+void lockIndexThreads (short type) {
+    if (nThreads == 0)
+        return;
+    if (type == F_UNLCK)
+        pthread_mutex_unlock(&indexLock);
+    else
+        pthread_mutex_lock(&indexLock);
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Compares the system calls made by the Servidor and all its Servidores Dedicados for each record-I/O mode
+# (--io stdio|pread|mmap): the Servidor runs under "strace -f -c" while loadgen.exe sends N requests, and the
+# calls per request are shown side by side. The database is restored after each run.
+#
+# Usage: ./so_syscalls_io.sh [N] [<binary-file.dat>]
+
+requests=${1:-2000}
+database=${2:-bd_passageiros.dat}
+modes="stdio pread mmap"
+syscalls="openat close newfstatat fstat lseek read write pread64 pwrite64 fcntl mmap munmap"
+
+command -v strace > /dev/null || { echo "strace is required" >&2; exit 1; }
+[[ -x ./servidor.exe && -x ./loadgen.exe && -f $database ]] || { echo "Run make first, next to $database" >&2; exit 1; }
+[[ $database == bd_passageiros.dat ]] || { echo "The Servidor always uses bd_passageiros.dat" >&2; exit 1; }
+
+set -m                                  # Background jobs must not ignore SIGINT (S3 expects the default handler)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cp "$database" "$work/original.dat"
+
+for mode in $modes; do
+    cp "$work/original.dat" "$database"
+    strace -f -c -o "$work/$mode.strace" ./servidor.exe --io "$mode" --delay none > "$work/$mode.log" 2>&1 &
+    sleep 1
+    ./loadgen.exe --requests "$requests" --concurrency 4 --database "$work/original.dat" | grep -E "^(C8|Latência)" | sed "s/^/$mode: /"
+    kill -INT $(pgrep -x -P $! servidor.exe)       # Shutdown (S6/S7), so that strace writes its summary
+    wait $!
+done
+cp "$work/original.dat" "$database"
+
+# strace -c rows: "% time  seconds  usecs/call  calls  [errors]  syscall" (the errors column may be empty)
+printf "\n%-12s" "syscall"
+for mode in $modes; do printf "%10s" "$mode"; done
+printf "   (calls per request, N = %d)\n" "$requests"
+for syscall in $syscalls total; do
+    printf "%-12s" "$syscall"
+    for mode in $modes; do
+        awk -v name="$syscall" -v n="$requests" '
+            $NF == name { calls = $4 }
+            END { printf "%10.2f", calls / n }' "$work/$mode.strace"
+    done
+    printf "\n"
+done